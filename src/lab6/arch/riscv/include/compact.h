@@ -0,0 +1,30 @@
+#ifndef __COMPACT_H__
+#define __COMPACT_H__
+
+#include "stdint.h"
+
+// 一次最多整理出 2^COMPACT_MAX_ORDER 页（一个 2 MiB 大页）
+#define COMPACT_MAX_ORDER 9
+// 整理失败后，之后同阶或更高阶的请求中只有每 2^defer_shift 次中的一次真正整理，每失败一次 defer_shift 加一
+#define COMPACT_MAX_DEFER_SHIFT 6
+
+struct compact_stat
+{
+    uint64_t attempts;  // compact_memory 的调用次数
+    uint64_t success;   // 其中整理出了空闲块的次数
+    uint64_t migrated;  // 迁移的页数
+    uint64_t deferred;  // 因为最近失败过而跳过的次数
+};
+
+extern struct compact_stat compact_stat;
+extern uint64_t compact_order; // /proc/compact：写入 order 时整理出一个 2^order 页的空闲块
+
+/*
+ * 内存整理：选出一个对齐的 nrpages 页的块（向上取到 2 的幂），把其中已分配的可移动页
+ * （只被用户页表和页缓存引用的单页）迁移到块外，使整个块回到 buddy。成功时返回 1。
+ * 高阶分配失败时由 alloc_pages 调用；最近失败过时按 COMPACT_MAX_DEFER_SHIFT 推迟，直接返回 0。
+ */
+int compact_memory(uint64_t nrpages);
+void compact_knob_write(uint64_t order);
+
+#endif
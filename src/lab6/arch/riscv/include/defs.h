@@ -27,13 +27,18 @@
 // lab2
 
 #define PHY_START 0x0000000080000000
-#define PHY_SIZE 128 * 1024 * 1024 // 128 MiB，QEMU 默认内存大小
+#define PHY_SIZE 128 * 1024 * 1024 // 128 MiB，QEMU 默认内存大小；实际大小在启动时从设备树读取（见 fdt.c），这里只作为缺省值
 #define PHY_END (PHY_START + PHY_SIZE)
 
 #define PGSIZE 0x1000 // 4 KiB
 #define PGROUNDUP(addr) ((addr + PGSIZE - 1) & (~(PGSIZE - 1)))
 #define PGROUNDDOWN(addr) (addr & (~(PGSIZE - 1)))
 
+#define HPAGE_SIZE 0x200000 // 2 MiB，sv39 二级页表项直接映射的大页
+#define HPAGE_NR (HPAGE_SIZE / PGSIZE)
+#define HPGROUNDUP(addr) ((addr + HPAGE_SIZE - 1) & (~(HPAGE_SIZE - 1)))
+#define HPGROUNDDOWN(addr) (addr & (~(HPAGE_SIZE - 1)))
+
 // lab3
 
 #define OPENSBI_SIZE (0x200000)
@@ -49,6 +54,11 @@
 #define PTE_W (1 << 2)
 #define PTE_X (1 << 3)
 #define PTE_U (1 << 4)
+#define PTE_G (1 << 5)
+#define PTE_A (1 << 6)
+#define PTE_D (1 << 7)
+#define PTE_SWAP (1 << 8) // RSW 位：PTE_V 为 0 时表示该页被换出，PPN 字段保存 swap slot
+#define PTE_PROT_NONE (1 << 9) // RSW 位：PROT_NONE 的页，PTE_V 为 0 但物理页仍然保留
 #define VPN0(vpn) ((vpn) << 12)
 #define VPN1(vpn) ((vpn) << 21)
 #define VPN2(vpn) ((vpn) << 30)
@@ -62,6 +72,8 @@
 #define PA2PPN1(addr) (((addr) >> 21) & 0x1ff)
 #define PA2PPN2(addr) (((addr) >> 30) & 0x3ffffff)
 #define PTE_IS_VALID(pte) ((pte) & PTE_V)
+#define PTE_IS_LEAF(pte) ((pte) & (PTE_R | PTE_W | PTE_X))
+#define PTE_IS_PRESENT(pte) ((pte) & (PTE_V | PTE_PROT_NONE)) // 映射了物理页（可能被 mprotect 暂时禁止访问）
 #define PA2PTE(addr) (((addr) >> 2) & 0x003ffffffffffc00)
 #define PTE2PA(pte) (((pte) & 0x003ffffffffffc00) << 2)
 #define PTE2VA(pte) (PA2VA_OFFSET + PTE2PA(pte))
@@ -73,6 +85,7 @@
 
 #define SATP_SV39 (8L << 60)
 #define SATP_PPN(addr) (((addr) >> 12) & 0xfffffffffff)
+#define SATP_ASID(asid) (((uint64_t)(asid) & 0xffff) << 44)
 #define PTE_FLAGS_MASK 0x3ff
 
 // lab4
@@ -82,11 +95,18 @@
 #define SPP (1L << 8)
 #define SPIE (1L << 5)
 #define SUM (1L << 18)
+#define SSTATUS_VS (3L << 9)
+#define SSTATUS_VS_INITIAL (1L << 9)
+#define SSTATUS_VS_CLEAN (2L << 9)
+#define SSTATUS_VS_DIRTY (3L << 9)
 
 // lab5
 #define VM_ANON 0x1
 #define VM_READ 0x2
 #define VM_WRITE 0x4
 #define VM_EXEC 0x8
+#define VM_SHARED 0x10 // MAP_SHARED：fork 后父子进程共享页面而不是写时复制
+#define VM_GROWSDOWN 0x20 // 用户栈：在下方缺页时向下扩展
+#define VM_MAYWRITE 0x40 // 允许 mprotect 加上 VM_WRITE：MAP_SHARED 的文件映射要求文件以可写方式打开
 
 #endif
@@ -0,0 +1,65 @@
+#ifndef __FDT_H__
+#define __FDT_H__
+
+#include "stdint.h"
+
+#define FDT_MAGIC 0xd00dfeed
+
+#define FDT_BEGIN_NODE 0x1
+#define FDT_END_NODE 0x2
+#define FDT_PROP 0x3
+#define FDT_NOP 0x4
+#define FDT_END 0x9
+
+#define FDT_MAX_DEPTH 16
+#define FDT_MAX_MEM_RANGES 8
+#define FDT_MAX_VIRTIO 8
+#define FDT_MAX_NODES 4 // NUMA 节点
+#define FDT_MAX_HARTS 8
+
+struct fdt_header
+{
+    uint32_t magic;
+    uint32_t totalsize;
+    uint32_t off_dt_struct;
+    uint32_t off_dt_strings;
+    uint32_t off_mem_rsvmap;
+    uint32_t version;
+    uint32_t last_comp_version;
+    uint32_t boot_cpuid_phys;
+    uint32_t size_dt_strings;
+    uint32_t size_dt_struct;
+};
+
+#define HWCAP_ISA(ext) (1UL << ((ext) - 'a')) // 与 Linux 的 COMPAT_HWCAP_ISA_* 相同
+
+struct mem_range
+{
+    uint64_t base;
+    uint64_t size;
+    uint64_t node; // 内存区间所在的 NUMA 节点（memory 节点的 numa-node-id）
+};
+
+/* 启动时从设备树中读出的硬件信息，fdt_init 之后设备树本身不再被访问 */
+struct boot_info
+{
+    uint64_t nr_mem;                              // 物理内存区间数量（按 base 升序）
+    struct mem_range mem[FDT_MAX_MEM_RANGES];
+    uint64_t timebase_freq;                       // time CSR 的频率
+    uint64_t nr_harts;
+    uint64_t hwcap;                               // 启动 hart 支持的单字母扩展，见 HWCAP_ISA
+    uint64_t nr_virtio;
+    struct mem_range virtio[FDT_MAX_VIRTIO];      // virtio-mmio 设备的寄存器区间
+    uint64_t boot_hart;                           // 启动 hart 的 hartid（boot_cpuid_phys）
+    uint64_t nr_nodes;                            // NUMA 节点数，没有 numa-node-id 时为 1
+    uint64_t hart_node[FDT_MAX_HARTS];            // 每个 hart 所在的节点（cpu 节点的 numa-node-id）
+    uint64_t node_distance[FDT_MAX_NODES][FDT_MAX_NODES]; // /distance-map，缺省时本节点 10、其他节点 20
+};
+
+extern uint64_t fdt_pa;
+extern struct boot_info boot_info;
+
+void fdt_init(void);
+uint64_t mem_end(void); // 最高物理地址（不含）
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __KSM_H__
+#define __KSM_H__
+
+#include "stdint.h"
+
+// 每隔 ksm_scan_interval 个时钟中断扫描 ksm_pages_to_scan 个页，可以通过 /proc/ksm_interval、/proc/ksm_pages 调整，0 表示关闭
+#define KSM_SCAN_INTERVAL 10
+#define KSM_SCAN_INTERVAL_MAX 1000
+#define KSM_PAGES_TO_SCAN 64
+#define KSM_PAGES_TO_SCAN_MAX 4096
+extern uint64_t ksm_scan_interval;
+extern uint64_t ksm_pages_to_scan;
+
+struct ksm_stat
+{
+    uint64_t full_scans;    // 完整扫描过所有进程的轮数
+    uint64_t pages_shared;  // 上一轮结束时仍被多个页表项共享的合并页
+    uint64_t pages_sharing; // 这些页多出来的映射数，即节省的页数
+    uint64_t merged;        // 累计合并的页表项数
+    uint64_t zero_merged;   // 其中全零、直接映射到零页的
+    uint64_t unmerged;      // 写入合并页时 COW 复制出私有页的次数
+};
+
+extern struct ksm_stat ksm_stat;
+
+void ksm_init(void);
+void ksm_tick(void); // 在 do_timer 中调用
+
+// 页是扫描器合并出来的，只读地映射在多个地方
+int page_ksm(void *page);
+
+// 页被迁移时，新页继承旧页的校验和与合并标记
+void ksm_migrate_page(void *old_page, void *new_page);
+
+#endif
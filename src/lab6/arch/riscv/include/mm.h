@@ -16,18 +16,40 @@ struct buddy {
   uint64_t size;
   uint64_t *bitmap;
   uint64_t *ref_cnt;
+  uint64_t base;    // 节点第一页的全局 pfn
+  uint64_t end;     // 节点覆盖的 pfn 上界（不含），size 补齐到 2 的幂后可能超过它
 };
 
+// 每个节点的分配统计：hit 本地分配成功，miss 本应本地却从该节点分配，foreign 本地节点的请求落到了别的节点
+struct numa_stat {
+  uint64_t hit;
+  uint64_t miss;
+  uint64_t foreign;
+};
+
+extern struct buddy buddies[];
+extern struct numa_stat numa_stat[];
+
 void buddy_init();
 uint64_t buddy_alloc(uint64_t);
 void buddy_free(uint64_t);
+void buddy_free_blocks(uint64_t *nr_blocks, uint64_t max_order);
+int buddy_page_free(uint64_t pfn);
+uint64_t buddy_total_pages();
+uint64_t buddy_node_free_pages(uint64_t nid);
+int pfn_to_nid(uint64_t pfn);   // 空洞返回 -1
+uint64_t numa_node_id(void);    // 当前 hart 所在的节点
 
 void *alloc_pages(uint64_t);
 void *alloc_page();
+void *alloc_huge_page();
 void free_pages(void *);
+void split_pages(void *, uint64_t);
 
 uint64_t get_page(void *);        // 增加计数
 void put_page(void *);            // 减少计数
 uint64_t get_page_refcnt(void *); // 获取计数
 
+extern void *zero_page; // 全局只读零页，mm_init 持有的引用永不释放
+
 #endif
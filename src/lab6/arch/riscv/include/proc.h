@@ -9,7 +9,9 @@
 #define FIRST_TASK task[0]
 #define LAST_TASK task[NR_TASKS - 1]
 
-#define TASK_RUNNING 0 // 为了简化实验，所有的线程都只有一种状态
+#define TASK_RUNNING 0
+#define TASK_BLOCKED 1 // vfork 的父进程，等待子进程 exec 或退出
+#define TASK_DEAD    2 // 已经退出，task_struct 等待 reap_dead_tasks 回收
 
 #define PRIORITY_MIN 1
 #define PRIORITY_MAX 10
@@ -37,6 +39,13 @@ struct task_struct
     uint64_t *pgd;
     struct mm_struct mm;
     struct files_struct *files;
+
+    uint64_t cpu_time;  // 运行期间经过的时钟中断数
+    struct fault_stat faults; // 缺页统计，见 do_page_fault
+    struct wss_stat wss;      // 各个 VMA 最近一次工作集扫描结果之和，见 wss.c
+    void *vstate;       // 换出时保存的向量寄存器，第一次用到 V 扩展时才分配，见 vector.c
+
+    struct task_struct *vfork_parent; // vfork 的子进程：借用的是这个进程的 mm 和页表，exec 或退出时归还
 };
 
 struct pt_regs
@@ -50,6 +59,33 @@ extern char __ret_from_fork[];
 /* 线程初始化，创建 NR_TASKS 个线程 */
 void task_init();
 
+/*
+ * 用 file 中的 ELF 可执行文件替换 task 的地址空间，成功时通过 entry 返回入口地址。
+ * 先完整检查 ELF，检查失败时返回 -1，原来的地址空间保持不变。
+ * 段映射为引用 file 的 VMA，内容在缺页时才读入；另外建立一个新的用户栈。
+ */
+struct file;
+int64_t load_elf(struct task_struct *task, struct file *file, uint64_t *entry);
+
+/*
+ * 分配一个空闲的 pid（task[] 中最小的空位），没有时返回 -1。
+ * 退出的进程在这里和 schedule 中被回收，pid 会被重用。
+ */
+int64_t alloc_pid(void);
+
+/*
+ * 创建一个新进程运行 path 中的 ELF 可执行文件，不复制当前进程的地址空间。
+ * files 为 NULL 时使用新的文件表，否则与之共享。成功时返回 pid，失败返回 -1。
+ */
+struct files_struct;
+int64_t do_spawn(const char *path, uint64_t priority, struct files_struct *files);
+
+// vfork 的子进程 exec 或退出时把地址空间还给父进程并唤醒它，子进程的 mm 变为空、pgd 为 NULL
+void vfork_release(struct task_struct *child);
+
+// 当前进程退出，释放地址空间和文件表后不再返回
+void do_exit(int64_t status);
+
 /* 在时钟中断处理中被调用，用于判断是否需要进行调度 */
 void do_timer();
 
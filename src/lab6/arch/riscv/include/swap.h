@@ -0,0 +1,34 @@
+#ifndef __SWAP_H__
+#define __SWAP_H__
+
+#include "stdint.h"
+
+#define SWAP_PARTITION_TYPE 0x82
+#define SECTORS_PER_PAGE (PGSIZE / VIRTIO_BLK_SECTOR_SIZE)
+
+// swap entry：PTE_V = 0，PTE_SWAP = 1，slot 保存在 PPN 字段
+#define IS_SWAP_PTE(pte) (!PTE_IS_VALID(pte) && ((pte) & PTE_SWAP))
+#define SWP_ENTRY(slot) (((uint64_t)(slot) << 10) | PTE_SWAP)
+#define SWP_SLOT(pte) ((pte) >> 10)
+
+// swap_map 是 8 位计数，达到上限后饱和：之后不再增减，slot 永远不会被释放
+#define SWAP_MAP_MAX 0xff
+
+struct swap_info
+{
+    uint64_t lba;       // swap 分区起始扇区
+    uint64_t nr_slots;  // 可容纳的页数
+    uint64_t nr_free;
+    uint64_t cursor;    // 下一次查找空闲 slot 的起点
+    uint8_t *swap_map;  // 每个 slot 被多少个 PTE 引用
+};
+
+extern struct swap_info swap_info;
+
+void swap_init(uint64_t lba, uint64_t sector_count);
+uint64_t swap_out(uint64_t nrpages);
+int swap_in(uint64_t *pte_p, uint64_t perm);
+void swap_dup(uint64_t pte);
+void swap_free(uint64_t pte);
+
+#endif
@@ -9,8 +9,52 @@
 #define SYS_LSEEK   62
 #define SYS_READ    63
 #define SYS_WRITE   64
+#define SYS_EXIT    93
+#define SYS_EXIT_GROUP 94
 #define SYS_GETPID  172
+#define SYS_MUNMAP  215
 #define SYS_CLONE   220
+#define SYS_EXECVE  221
+#define SYS_MMAP    222
+#define SYS_MPROTECT 226
+#define SYS_RISCV_HWPROBE 258
+#define SYS_SPAWN   400 // 不是 Linux 的系统调用：posix_spawn 风格，直接从可执行文件创建新进程
+#define SYS_FAULTSTAT 401 // 不是 Linux 的系统调用：读取缺页统计和最近的缺页记录
+
+// clone 的 flags，与 Linux 相同；CLONE_VFORK | CLONE_VM 时按 vfork 处理，其他情况都按 fork 处理
+#define CLONE_VM    0x100
+#define CLONE_VFORK 0x4000
+
+// mmap / mprotect 的参数，与 Linux 相同
+#define PROT_NONE  0x0
+#define PROT_READ  0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC  0x4
+
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_FIXED     0x10
+#define MAP_ANONYMOUS 0x20
+
+#define MMAP_BASE 0x2000000000UL // 没有提示地址时从这里向上寻找空闲区间
+#define MMAP_MIN_ADDR 0x10000UL  // 不允许映射最低的几页，保证空指针访问出错
+
+// riscv_hwprobe 的 key / value，与 Linux 的 <asm/hwprobe.h> 一致，只实现其中一部分
+#define RISCV_HWPROBE_KEY_MVENDORID     0
+#define RISCV_HWPROBE_KEY_MARCHID       1
+#define RISCV_HWPROBE_KEY_MIMPID        2
+#define RISCV_HWPROBE_KEY_BASE_BEHAVIOR 3
+#define RISCV_HWPROBE_BASE_BEHAVIOR_IMA (1 << 0)
+#define RISCV_HWPROBE_KEY_IMA_EXT_0     4
+#define RISCV_HWPROBE_IMA_FD            (1 << 0)
+#define RISCV_HWPROBE_IMA_C             (1 << 1)
+#define RISCV_HWPROBE_IMA_V             (1 << 2)
+
+struct riscv_hwprobe
+{
+    int64_t key;
+    uint64_t value;
+};
 
 extern struct task_struct *current;
 
@@ -0,0 +1,15 @@
+#ifndef __VECTOR_H__
+#define __VECTOR_H__
+
+#include "stdint.h"
+
+extern int has_vector; // 启动 hart 是否支持 V 扩展
+
+struct task_struct;
+
+void vector_init(void);
+void vector_switch(struct task_struct *prev, struct task_struct *next); // 在 __switch_to 之前调用
+void vector_fork(struct task_struct *child);                            // 子进程继承当前的向量寄存器
+void vector_exit(struct task_struct *task);                             // 回收 task_struct 时释放保存的向量寄存器
+
+#endif
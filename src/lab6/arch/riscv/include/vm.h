@@ -1,9 +1,29 @@
 #ifndef __VM_H__
 #define __VM_H__
 
+#include "stdint.h"
+#include "rbtree.h"
+
+struct file;
+
+#define VMACACHE_SIZE 4
+#define VMACACHE_HASH(addr) (((addr) >> 12) & (VMACACHE_SIZE - 1))
+
 struct mm_struct
 {
-        struct vm_area_struct *mmap;
+        struct vm_area_struct *mmap;                     // 按地址排序的 VMA 链表
+        struct rb_root mm_rb;                            // 按 vm_start 索引的红黑树，附加子树中最大的空洞
+        struct vm_area_struct *vmacache[VMACACHE_SIZE]; // 最近命中的 VMA，按页号散列
+        uint64_t last_fault_va;                          // 上一次缺页的页地址，用于识别顺序访问
+        uint64_t asid;                                   // 地址空间标识，取进程的 pid
+};
+
+// 工作集扫描的结果（见 wss.c），单位为页：idle[0] 是最近一轮被访问过的页，idle[i] 是 2^(i-1) 轮以上没有访问的页
+#define WSS_NR_BUCKETS 5
+struct wss_stat
+{
+        uint64_t idle[WSS_NR_BUCKETS];
+        uint64_t dirty; // PTE_D 置位的页
 };
 
 struct vm_area_struct
@@ -13,16 +33,125 @@ struct vm_area_struct
         uint64_t vm_end;                          // VMA 对应的用户态虚拟地址的结束
         struct vm_area_struct *vm_next, *vm_prev; // 链表指针
         uint64_t vm_flags;                        // VMA 对应的 flags
-        // struct file *vm_file;    // 对应的文件（目前还没实现，而且我们只有一个 uapp 所以暂不需要）
+        struct file *vm_file; // mmap 的文件（VMA 自己持有的一份拷贝），为 NULL 时文件内容来自 uapp（_sramdisk）
         uint64_t vm_pgoff;  // 如果对应了一个文件，那么这块 VMA 起始地址对应的文件内容相对文件起始位置的偏移量
         uint64_t vm_filesz; // 对应的文件内容的长度
+
+        struct rb_node vm_rb;
+        uint64_t vm_gap;     // 从前一个 VMA（或 USER_START）的末尾开始，可以分配给新映射的空洞大小
+        uint64_t vm_max_gap; // 子树中最大的 vm_gap
+
+        struct wss_stat vm_wss; // 最近一次扫描的结果
 };
 
 void create_mapping(uint64_t *pgtbl, uint64_t va, uint64_t pa, uint64_t sz, uint64_t perm);
 void setup_vm_final(void);
-uint64_t *sv39_pg_dir_dup(uint64_t *pgtbl);
+uint64_t *sv39_pg_dir_dup(uint64_t *pgtbl); // 内存不足时返回 NULL
+void create_kernel_mapping(uint64_t va, uint64_t pa, uint64_t sz, uint64_t perm);
 uint64_t *find_pte(uint64_t*pgtbl, uint64_t va);
 
+/* 2 MiB 大页：二级页表中的叶子项 */
+uint64_t *find_huge_pte(uint64_t *pgtbl, uint64_t va);
+int create_huge_mapping(uint64_t *pgtbl, uint64_t va, uint64_t pa, uint64_t perm);
+int split_huge_mapping(uint64_t *pgtbl, uint64_t va); // 没有内存存放末级页表时返回 -1
+
+extern uint64_t nr_vmas;
+
+// 缺页时顺带映射的页数（含缺页本身），可以通过 /proc/fault_around 调整，不超过 512
+#define FAULT_AROUND_PAGES 16
+#define FAULT_AROUND_MAX 512
+extern uint64_t fault_around_pages;
+uint64_t mm_rss(uint64_t *pgtbl, struct mm_struct *mm);
+
+// 缺页的分类，见 do_page_fault
+#define FAULT_ZERO      0 // 匿名空间和 bss：映射零页或分配清零的页（包括大页）
+#define FAULT_FILE      1 // 文件内容：ELF 段、mmap 的文件
+#define FAULT_SWAP      2 // 从 swap 读回
+#define FAULT_COW_COPY  3 // 写时复制，复制了一页
+#define FAULT_COW_REUSE 4 // 写时复制，页只有一个引用，直接恢复写权限
+#define NR_FAULT_TYPES  5
+
+// 缺页统计，每个进程一份，另有一份全局的。处理时读了磁盘（swap、页缓存未命中）的是 major，其余是 minor
+struct fault_stat
+{
+    uint64_t minor, major;
+    uint64_t count[NR_FAULT_TYPES];
+    uint64_t cycles[NR_FAULT_TYPES]; // 处理时间，get_cycles 的差值
+    uint64_t around;                 // fault-around 顺带映射的页数
+    uint64_t huge;                   // 用大页满足的缺页数
+};
+
+// 最近的缺页记录，/proc/fault_trace 非 0 时写入 FAULT_TRACE_SIZE 项的环形缓冲区
+struct fault_record
+{
+    uint64_t pid, pc, va;
+    uint64_t type, major, cycles;
+};
+
+#define FAULT_TRACE_SIZE 64
+extern struct fault_stat fault_stat;
+extern uint64_t fault_trace;
+
+// 从旧到新拷贝最多 n 条最近的缺页记录，返回条数
+uint64_t fault_trace_read(struct fault_record *buf, uint64_t n);
+
+// 用户栈向下增长，大小不超过 stack_limit_pages（可以通过 /proc/stack_limit 调整），
+// 与下面的 VMA 之间至少留出 STACK_GUARD_GAP；mmap 不会把新映射放到栈的增长范围内
+#define STACK_LIMIT_PAGES 2048       // 8 MiB
+#define STACK_LIMIT_MAX (1UL << 18) // 1 GiB
+#define STACK_GUARD_GAP (256 * PGSIZE)
+extern uint64_t stack_limit_pages;
+void stack_limit_write(uint64_t pages); // /proc/stack_limit 写入之后调用，更新所有进程的栈
+
+// 查找包含 addr 的 VMA；addr 在栈的下方时先扩展栈，超出上限或碰到保护间隔时返回 NULL
+struct vm_area_struct *find_extend_vma(struct mm_struct *mm, uint64_t addr);
+
+// 初始化一个没有任何 VMA 的 mm_struct
+void mm_struct_init(struct mm_struct *mm, uint64_t asid);
+
+// 为 VMA 复制一份 file，内存不足时返回 NULL
+struct file *vma_file_dup(struct file *file);
+
+// 解除 [start, start + len) 的映射，必要时拆分 VMA，释放其中的物理页和 swap slot
+int do_munmap(struct mm_struct *mm, uint64_t *pgtbl, uint64_t start, uint64_t len);
+
+// 进程退出时释放整个用户地址空间：所有 VMA、物理页、swap slot 以及用户部分的页表页，pgtbl 本身由调用者释放
+void exit_mmap(struct mm_struct *mm, uint64_t *pgtbl);
+
+// 把 [start, start + len) 的权限改为 vm_prot（VM_READ | VM_WRITE | VM_EXEC），区间必须已经全部映射
+int do_mprotect(struct mm_struct *mm, uint64_t *pgtbl, uint64_t start, uint64_t len, uint64_t vm_prot);
+
+/*
+ * fork 时把 src 中 [start, end) 的映射复制到 dst：两棵页表逐级同步遍历，没有下级页表的区间整段跳过。
+ * 末级页表不复制，父子进程共享同一张（页表页的引用计数加一），其中的页表项按 cow_mask 处理写权限；
+ * 物理页和 swap slot 的引用计数按引用它们的页表计算，页表被复制时才增加。
+ * 不刷新 TLB，由调用者在全部复制完之后刷新一次。
+ * 没有内存存放页表时返回 -1，已经复制的页表项留在 dst 中，由调用者连同整个地址空间一起释放。
+ */
+int copy_page_range(uint64_t *dst, uint64_t *src, uint64_t start, uint64_t end, uint64_t cow_mask);
+
+// 修改 va 所在 2 MiB 区域的页表项之前调用：末级页表被共享时为 pgtbl 复制一份私有的，内存不足时返回 -1
+int unshare_pte_table(struct mm_struct *mm, uint64_t *pgtbl, uint64_t va);
+
+/*
+ * TLB 刷新。每个地址空间用自己的 ASID，切换进程时不再刷新 TLB，
+ * 所以修改了页表项之后必须刷新对应地址空间里的这些地址：
+ * flush_tlb_page / flush_tlb_range 对每一页执行 sfence.vma va, asid，页数超过上限时退化为 flush_tlb_mm；
+ * flush_tlb_mm 刷新整个地址空间，修改了非叶子页表项时也要用它；
+ * flush_tlb_all 刷新所有地址空间，用于可能被多个地址空间共享的页表。
+ */
+void flush_tlb_page(struct mm_struct *mm, uint64_t va);
+void flush_tlb_range(struct mm_struct *mm, uint64_t start, uint64_t end);
+void flush_tlb_mm(struct mm_struct *mm);
+void flush_tlb_all(void);
+
+// 切换到 next 的页表
+struct task_struct;
+void switch_mm(struct task_struct *next);
+
+// 在 [low, USER_END) 中找最低的、长度至少为 len 的空闲区间，返回起始地址，找不到返回 -1
+uint64_t get_unmapped_area(struct mm_struct *mm, uint64_t low, uint64_t len);
+
 /*
  * @mm       : current thread's mm_struct
  * @addr     : the va to look up
@@ -39,7 +168,7 @@ struct vm_area_struct *find_vma(struct mm_struct *mm, uint64_t addr);
  * @vm_filesz: phdr->p_filesz
  * @flags    : flags for the new VMA
  *
- * @return   : start va
+ * @return   : start va, or -1 if it overlaps an existing VMA or there is no memory for the VMA
  */
 uint64_t do_mmap(struct mm_struct *mm, uint64_t addr, uint64_t len, uint64_t vm_pgoff, uint64_t vm_filesz, uint64_t flags);
 
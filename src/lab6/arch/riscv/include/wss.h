@@ -0,0 +1,22 @@
+#ifndef __WSS_H__
+#define __WSS_H__
+
+#include "stdint.h"
+
+// 每隔 wss_scan_interval 个时钟中断扫描一遍所有进程的页表，可以通过 /proc/wss_interval 调整，0 表示关闭。
+// 每一轮的开销与映射的页数成正比，并且要刷新被扫描进程的 TLB，默认关闭
+#define WSS_SCAN_INTERVAL 0
+#define WSS_SCAN_INTERVAL_MAX 1000
+extern uint64_t wss_scan_interval;
+extern uint64_t nr_wss_scans; // 已经完成的扫描轮数
+
+void wss_init(void);
+void wss_tick(void); // 在 do_timer 中调用
+
+// 页在最近一轮扫描中被访问过（扫描器已经清除了它的 A 位）。扫描器关闭或没有扫描到时返回 0
+int page_recently_accessed(void *page);
+
+// 页被迁移时，新页继承旧页的空闲轮数
+void wss_migrate_page(void *old_page, void *new_page);
+
+#endif
@@ -0,0 +1,281 @@
+#include "compact.h"
+#include "defs.h"
+#include "mm.h"
+#include "vm.h"
+#include "proc.h"
+#include "string.h"
+#include "pagecache.h"
+#include "wss.h"
+#include "ksm.h"
+
+struct compact_stat compact_stat;
+uint64_t compact_order;
+
+// 推迟整理的状态：order_failed 阶及以上的请求，每 2^defer_shift 次才整理一次
+static uint64_t defer_shift, defer_considered, order_failed = COMPACT_MAX_ORDER + 1;
+
+#define PFN2VA(pfn) ((void *)PA2VA(PFN2PHYS(pfn)))
+#define COMPACT_HELD (~0UL) // 块内的空闲页被分配为迁移目标时先占住，整理结束后放回
+
+/*
+ * 反向映射：遍历所有进程的用户页表，对每个指向 [start, start + nr) 中物理页的页表项调用 fn。
+ * fork 之后共享的末级页表、vfork 父子进程共用的页表只访问一次。大页中的页不会被迁移，不访问。
+ */
+struct rmap_walk
+{
+    uint64_t start, nr;
+    void (*fn)(struct rmap_walk *walk, uint64_t *pte_p, uint64_t i);
+    uint32_t *refs;     // 每个页被多少个页表项引用
+    uint64_t *new_pfns; // 每个页迁移到的 pfn
+    uint64_t **seen;    // 已经访问过的共享页表
+    uint64_t nr_seen;
+    int overflow;
+};
+
+#define RMAP_SEEN_MAX (PGSIZE / sizeof(uint64_t *))
+
+// 返回 1 表示 table 已经访问过（或者记录不下），应当跳过
+static int rmap_seen(struct rmap_walk *walk, uint64_t *table)
+{
+    for (uint64_t i = 0; i < walk->nr_seen; i++)
+    {
+        if (walk->seen[i] == table)
+            return 1;
+    }
+    if (walk->nr_seen == RMAP_SEEN_MAX)
+    {
+        walk->overflow = 1;
+        return 1;
+    }
+    walk->seen[walk->nr_seen++] = table;
+    return 0;
+}
+
+static void rmap_walk(struct rmap_walk *walk)
+{
+    walk->nr_seen = 0;
+    for (uint64_t pid = 1; pid < NR_TASKS; pid++)
+    {
+        struct task_struct *t = task[pid];
+        if (!t || !t->pgd || rmap_seen(walk, t->pgd))
+            continue;
+        for (uint64_t vpn2 = VA2VPN2(USER_START); vpn2 <= VA2VPN2(USER_END - 1); vpn2++)
+        {
+            if (!PTE_IS_VALID(t->pgd[vpn2]) || PTE_IS_LEAF(t->pgd[vpn2]))
+                continue;
+            uint64_t *pgtbl1 = (uint64_t *)PTE2VA(t->pgd[vpn2]);
+            for (uint64_t vpn1 = 0; vpn1 < PGSIZE / sizeof(uint64_t); vpn1++)
+            {
+                if (!PTE_IS_VALID(pgtbl1[vpn1]) || PTE_IS_LEAF(pgtbl1[vpn1]))
+                    continue;
+                uint64_t *pgtbl0 = (uint64_t *)PTE2VA(pgtbl1[vpn1]);
+                if (get_page_refcnt(pgtbl0) > 1 && rmap_seen(walk, pgtbl0))
+                    continue;
+                for (uint64_t vpn0 = 0; vpn0 < PGSIZE / sizeof(uint64_t); vpn0++)
+                {
+                    if (!PTE_IS_PRESENT(pgtbl0[vpn0]))
+                        continue;
+                    uint64_t pfn = PHYS2PFN(PTE2PA(pgtbl0[vpn0]));
+                    if (pfn >= walk->start && pfn < walk->start + walk->nr)
+                        walk->fn(walk, &pgtbl0[vpn0], pfn - walk->start);
+                }
+            }
+        }
+    }
+}
+
+static void count_ref(struct rmap_walk *walk, uint64_t *pte_p, uint64_t i)
+{
+    walk->refs[i]++;
+}
+
+static void remap_pte(struct rmap_walk *walk, uint64_t *pte_p, uint64_t i)
+{
+    if (walk->new_pfns[i] && walk->new_pfns[i] != COMPACT_HELD)
+        *pte_p = (*pte_p & PTE_FLAGS_MASK) | PA2PTE(PFN2PHYS(walk->new_pfns[i]));
+}
+
+// 分配一个块外的页作为迁移目标，落在块内的空闲页先占住
+static uint64_t alloc_target(struct rmap_walk *walk)
+{
+    while (1)
+    {
+        uint64_t pfn = buddy_alloc(1);
+        if (pfn == 0)
+            return 0;
+        if (pfn < walk->start || pfn >= walk->start + walk->nr)
+            return pfn;
+        walk->new_pfns[pfn - walk->start] = COMPACT_HELD;
+    }
+}
+
+// 整理 [start, start + nr)，整个块都空出来时返回 0
+static int compact_block(struct rmap_walk *walk)
+{
+    // 块内已分配的页都要是单独分配的页（多页分配的非首页、不存在的内存引用计数为 0）
+    uint64_t used = 0;
+    for (uint64_t i = 0; i < walk->nr; i++)
+    {
+        if (buddy_page_free(walk->start + i))
+            continue;
+        if (get_page_refcnt(PFN2VA(walk->start + i)) == 0)
+            return -1;
+        used++;
+    }
+    if (used == 0)
+        return 0;
+
+    // 引用计数必须全部来自用户页表项和页缓存，否则页被内核的其他地方使用着
+    memset(walk->refs, 0, walk->nr * sizeof(*walk->refs));
+    walk->fn = count_ref;
+    rmap_walk(walk);
+    if (walk->overflow)
+        return -1;
+    for (uint64_t i = 0; i < walk->nr; i++)
+    {
+        void *page = PFN2VA(walk->start + i);
+        if (buddy_page_free(walk->start + i))
+            continue;
+        if (get_page_refcnt(page) != walk->refs[i] + (page_cache_find_page(page) ? 1 : 0))
+            return -1;
+    }
+
+    // 逐页复制到块外，引用计数和页缓存项一起转移；全部复制完后统一修改页表项
+    int ret = 0;
+    memset(walk->new_pfns, 0, walk->nr * sizeof(*walk->new_pfns));
+    for (uint64_t i = 0; i < walk->nr; i++)
+    {
+        void *page = PFN2VA(walk->start + i);
+        if (walk->new_pfns[i] == COMPACT_HELD || buddy_page_free(walk->start + i))
+            continue;
+        uint64_t target = alloc_target(walk);
+        if (target == 0)
+        {
+            ret = -1;
+            break;
+        }
+        void *new_page = PFN2VA(target);
+        memcpy(new_page, page, PGSIZE);
+        for (uint64_t ref = get_page_refcnt(page); ref > 1; ref--)
+            get_page(new_page);
+        page_cache_migrate_page(page, new_page);
+        wss_migrate_page(page, new_page);
+        ksm_migrate_page(page, new_page);
+        walk->new_pfns[i] = target;
+        compact_stat.migrated++;
+    }
+    walk->fn = remap_pte;
+    rmap_walk(walk);
+    flush_tlb_all();
+
+    // 旧页已经没有任何引用，连同占住的空闲页一起还给 buddy，合并回整块
+    for (uint64_t i = 0; i < walk->nr; i++)
+    {
+        void *page = PFN2VA(walk->start + i);
+        if (walk->new_pfns[i] == COMPACT_HELD)
+            put_page(page);
+        else if (walk->new_pfns[i])
+        {
+            while (get_page_refcnt(page))
+                put_page(page);
+        }
+    }
+    return ret;
+}
+
+// 整理出一个对齐的 nr 页（2 的幂）的空闲块
+static int compact_blocks(uint64_t nr)
+{
+    if (nr > (1UL << COMPACT_MAX_ORDER) || nr > buddy_total_pages())
+        return 0;
+    compact_stat.attempts++;
+    struct rmap_walk walk;
+    walk.refs = (uint32_t *)alloc_page();
+    walk.new_pfns = (uint64_t *)alloc_page();
+    walk.seen = (uint64_t **)alloc_page();
+    int ok = 0;
+    if (walk.refs && walk.new_pfns && walk.seen)
+    {
+        walk.nr = nr;
+        // buddy 从低地址开始分配，从高地址的块开始整理，迁移目标不容易落在块内
+        for (uint64_t start = (buddy_total_pages() / nr - 1) * nr;; start -= nr)
+        {
+            // 块必须整个落在同一个节点内，并且按节点内的页号对齐，释放后才能合并成整块
+            int nid = pfn_to_nid(start);
+            if (nid < 0 || pfn_to_nid(start + nr - 1) != nid || (start - buddies[nid].base) % nr)
+            {
+                if (start == 0)
+                    break;
+                continue;
+            }
+            walk.start = start;
+            walk.overflow = 0;
+            if (compact_block(&walk) == 0)
+            {
+                ok = 1;
+                break;
+            }
+            if (start == 0)
+                break;
+        }
+    }
+    if (walk.refs)
+        put_page(walk.refs);
+    if (walk.new_pfns)
+        put_page(walk.new_pfns);
+    if (walk.seen)
+        put_page(walk.seen);
+    if (ok)
+        compact_stat.success++;
+    return ok;
+}
+
+// 碎片化时每次失败的整理都要遍历所有进程的页表，最近失败过的阶先跳过若干次
+static int compact_deferred(uint64_t order)
+{
+    if (order < order_failed)
+        return 0;
+    if (++defer_considered >= (1UL << defer_shift))
+    {
+        defer_considered = 1UL << defer_shift;
+        return 0;
+    }
+    compact_stat.deferred++;
+    return 1;
+}
+
+static void compact_defer_update(uint64_t order, int ok)
+{
+    if (ok)
+    {
+        defer_shift = 0;
+        defer_considered = 0;
+        if (order >= order_failed)
+            order_failed = order + 1;
+        return;
+    }
+    defer_considered = 0;
+    if (defer_shift < COMPACT_MAX_DEFER_SHIFT)
+        defer_shift++;
+    if (order < order_failed)
+        order_failed = order;
+}
+
+int compact_memory(uint64_t nrpages)
+{
+    uint64_t order = 0;
+    while ((1UL << order) < nrpages)
+        order++;
+    if (order > COMPACT_MAX_ORDER || compact_deferred(order))
+        return 0;
+    int ok = compact_blocks(1UL << order);
+    compact_defer_update(order, ok);
+    return ok;
+}
+
+// 手动整理不受推迟限制
+void compact_knob_write(uint64_t order)
+{
+    if (compact_blocks(1UL << order))
+        compact_defer_update(order, 1);
+}
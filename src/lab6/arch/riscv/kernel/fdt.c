@@ -0,0 +1,285 @@
+#include "fdt.h"
+#include "defs.h"
+#include "string.h"
+#include "printk.h"
+#include "virtio.h"
+
+extern uint64_t TIMECLOCK;
+
+uint64_t fdt_pa;            // OpenSBI 通过 a1 传入的设备树物理地址，由 setup_vm 保存
+struct boot_info boot_info;
+
+#define FDT_ALIGN(x) (((x) + 3) & ~3) // 结构块中的名字和属性值按 4 字节对齐
+
+static inline uint32_t fdt32(const void *p)
+{
+    const uint8_t *b = (const uint8_t *)p;
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+// 读取 cells 个 32 位大端 cell 组成的数
+static uint64_t fdt_cells(const uint8_t **p, uint32_t cells)
+{
+    uint64_t ret = 0;
+    for (uint32_t i = 0; i < cells; i++)
+    {
+        ret = (ret << 32) | fdt32(*p);
+        *p += 4;
+    }
+    return ret;
+}
+
+static int prefix(const char *s, const char *pre)
+{
+    return memcmp(s, pre, strlen(pre)) == 0;
+}
+
+static void add_mem_range(uint64_t base, uint64_t size, uint64_t node)
+{
+    if (boot_info.nr_mem >= FDT_MAX_MEM_RANGES || size == 0)
+        return;
+    // 内核按 PHY_START 计算 pfn，低于 PHY_START 的内存不使用
+    if (base + size <= PHY_START)
+        return;
+    if (base < PHY_START)
+    {
+        size -= PHY_START - base;
+        base = PHY_START;
+    }
+    // 插入排序，保持按 base 升序
+    uint64_t i = boot_info.nr_mem++;
+    while (i > 0 && boot_info.mem[i - 1].base > base)
+    {
+        boot_info.mem[i] = boot_info.mem[i - 1];
+        i--;
+    }
+    boot_info.mem[i].base = base;
+    boot_info.mem[i].size = size;
+    boot_info.mem[i].node = node;
+}
+
+// riscv,isa = "rv64imafdcv_zicsr_..."：取 rv64 之后、第一个 '_' 之前的单字母扩展
+static uint64_t parse_isa(const char *isa)
+{
+    uint64_t hwcap = 0;
+    if (prefix(isa, "rv32") || prefix(isa, "rv64"))
+        isa += 4;
+    for (; *isa && *isa != '_'; isa++)
+    {
+        if (*isa >= 'a' && *isa <= 'z')
+            hwcap |= HWCAP_ISA(*isa);
+    }
+    if (hwcap & HWCAP_ISA('g'))
+        hwcap |= HWCAP_ISA('i') | HWCAP_ISA('m') | HWCAP_ISA('a') | HWCAP_ISA('f') | HWCAP_ISA('d');
+    return hwcap;
+}
+
+// riscv,isa-extensions = "i", "m", ..., "v", "zicsr", ...（字符串列表）
+static uint64_t parse_isa_extensions(const char *val, uint32_t len)
+{
+    uint64_t hwcap = 0;
+    const char *end = val + len;
+    while (val < end)
+    {
+        if (val[0] >= 'a' && val[0] <= 'z' && val[1] == '\0')
+            hwcap |= HWCAP_ISA(val[0]);
+        val += strlen(val) + 1;
+    }
+    return hwcap;
+}
+
+// 节点的属性，可能以任意顺序出现，在 FDT_END_NODE 时再统一处理；每层一份，子节点不会覆盖父节点的
+struct fdt_node
+{
+    const uint8_t *reg;
+    uint32_t reg_len;
+    int is_memory, is_virtio, is_cpu;
+    uint64_t numa_node; // numa-node-id
+    uint64_t hwcap;     // cpu 节点的扩展；采用 reg 等于 boot_cpuid_phys 的节点（启动 hart）
+};
+
+static void fdt_parse(struct fdt_header *fdt)
+{
+    const uint8_t *p = (const uint8_t *)fdt + fdt32(&fdt->off_dt_struct);
+    const char *strings = (const char *)fdt + fdt32(&fdt->off_dt_strings);
+
+    // addr_cells[d] / size_cells[d]：深度为 d 的节点为其子节点规定的 #address-cells / #size-cells
+    uint32_t addr_cells[FDT_MAX_DEPTH], size_cells[FDT_MAX_DEPTH];
+    const char *names[FDT_MAX_DEPTH];
+    struct fdt_node nodes[FDT_MAX_DEPTH], *n = NULL;
+    int depth = -1;
+    uint64_t first_hwcap = 0; // 找不到启动 hart 的节点时退回第一个 cpu 节点
+
+    while (1)
+    {
+        uint32_t token = fdt32(p);
+        p += 4;
+        if (token == FDT_BEGIN_NODE)
+        {
+            const char *name = (const char *)p;
+            p += FDT_ALIGN(strlen(name) + 1);
+            if (++depth >= FDT_MAX_DEPTH)
+            {
+                Err("device tree too deep");
+            }
+            names[depth] = name;
+            addr_cells[depth] = 2;
+            size_cells[depth] = 1;
+            n = &nodes[depth];
+            memset(n, 0, sizeof(*n));
+            n->is_memory = depth == 1 && prefix(name, "memory");
+            n->is_cpu = depth == 2 && prefix(names[1], "cpus") && prefix(name, "cpu@");
+            if (n->is_cpu)
+                boot_info.nr_harts++;
+        }
+        else if (token == FDT_END_NODE)
+        {
+            if (depth < 0)
+                break;
+            const uint8_t *reg = n->reg;
+            if (reg && depth >= 1)
+            {
+                uint32_t ac = addr_cells[depth - 1], sc = size_cells[depth - 1];
+                const uint8_t *end = reg + n->reg_len;
+                while (reg + 4 * (ac + sc) <= end)
+                {
+                    uint64_t base = fdt_cells(&reg, ac);
+                    uint64_t size = fdt_cells(&reg, sc);
+                    if (n->is_memory)
+                        add_mem_range(base, size, n->numa_node);
+                    else if (n->is_cpu)
+                    {
+                        // cpu 节点的 reg 是 hartid，没有 size
+                        if (base < FDT_MAX_HARTS)
+                            boot_info.hart_node[base] = n->numa_node;
+                        if (base == boot_info.boot_hart)
+                            boot_info.hwcap = n->hwcap;
+                        break;
+                    }
+                    else if (n->is_virtio && boot_info.nr_virtio < FDT_MAX_VIRTIO)
+                    {
+                        boot_info.virtio[boot_info.nr_virtio].base = base;
+                        boot_info.virtio[boot_info.nr_virtio].size = size;
+                        boot_info.nr_virtio++;
+                        break;
+                    }
+                }
+            }
+            if (n->is_cpu && first_hwcap == 0)
+                first_hwcap = n->hwcap;
+            n = --depth >= 0 ? &nodes[depth] : NULL;
+        }
+        else if (token == FDT_PROP)
+        {
+            uint32_t len = fdt32(p);
+            const char *name = strings + fdt32(p + 4);
+            const uint8_t *val = p + 8;
+            p += 8 + FDT_ALIGN(len);
+            if (!n)
+                continue;
+            if (strcmp(name, "#address-cells") == 0)
+                addr_cells[depth] = fdt32(val);
+            else if (strcmp(name, "#size-cells") == 0)
+                size_cells[depth] = fdt32(val);
+            else if (strcmp(name, "reg") == 0)
+            {
+                n->reg = val;
+                n->reg_len = len;
+            }
+            else if (strcmp(name, "device_type") == 0 && strcmp((const char *)val, "memory") == 0)
+                n->is_memory = 1;
+            else if (strcmp(name, "compatible") == 0 && strcmp((const char *)val, "virtio,mmio") == 0)
+                n->is_virtio = 1;
+            else if (strcmp(name, "riscv,isa-extensions") == 0)
+                n->hwcap = parse_isa_extensions((const char *)val, len);
+            else if (strcmp(name, "riscv,isa") == 0 && n->hwcap == 0)
+                n->hwcap = parse_isa((const char *)val);
+            else if (strcmp(name, "numa-node-id") == 0)
+                n->numa_node = fdt32(val) < FDT_MAX_NODES ? fdt32(val) : 0;
+            else if (strcmp(name, "distance-matrix") == 0)
+            {
+                // <node-a node-b distance> 三元组
+                for (const uint8_t *q = val; q + 12 <= val + len; q += 12)
+                {
+                    if (fdt32(q) < FDT_MAX_NODES && fdt32(q + 4) < FDT_MAX_NODES)
+                        boot_info.node_distance[fdt32(q)][fdt32(q + 4)] = fdt32(q + 8);
+                }
+            }
+            else if (strcmp(name, "timebase-frequency") == 0)
+                boot_info.timebase_freq = len == 8 ? ((uint64_t)fdt32(val) << 32) | fdt32(val + 4) : fdt32(val);
+        }
+        else if (token == FDT_NOP)
+        {
+            continue;
+        }
+        else
+        {
+            break; // FDT_END 或无法识别的 token
+        }
+    }
+    if (boot_info.hwcap == 0)
+        boot_info.hwcap = first_hwcap;
+}
+
+void fdt_init(void)
+{
+    struct fdt_header *fdt = (struct fdt_header *)PA2VA(fdt_pa);
+    if (fdt_pa && fdt32(&fdt->magic) == FDT_MAGIC)
+    {
+        boot_info.boot_hart = fdt32(&fdt->boot_cpuid_phys);
+        fdt_parse(fdt);
+    }
+    else
+    {
+        printk(RED "no device tree found at %lx, using defaults\n" CLEAR, fdt_pa);
+    }
+
+    // 设备树缺失对应信息时回退到 QEMU virt 的默认配置
+    if (boot_info.nr_mem == 0)
+        add_mem_range(PHY_START, PHY_SIZE, 0);
+    if (boot_info.timebase_freq == 0)
+        boot_info.timebase_freq = 10000000;
+    if (boot_info.nr_harts == 0)
+        boot_info.nr_harts = 1;
+    if (boot_info.nr_virtio == 0)
+    {
+        for (int i = 0; i < VIRTIO_COUNT; i++)
+        {
+            boot_info.virtio[i].base = VIRTIO_START + i * VIRTIO_SIZE;
+            boot_info.virtio[i].size = VIRTIO_SIZE;
+        }
+        boot_info.nr_virtio = VIRTIO_COUNT;
+    }
+
+    TIMECLOCK = boot_info.timebase_freq;
+
+    // 节点数取内存区间中最大的节点号，没有给出的距离按本节点 10、其他节点 20 补齐
+    for (uint64_t i = 0; i < boot_info.nr_mem; i++)
+    {
+        if (boot_info.mem[i].node >= boot_info.nr_nodes)
+            boot_info.nr_nodes = boot_info.mem[i].node + 1;
+    }
+    if (boot_info.boot_hart >= FDT_MAX_HARTS)
+        boot_info.boot_hart = 0;
+    for (uint64_t i = 0; i < boot_info.nr_nodes; i++)
+    {
+        for (uint64_t j = 0; j < boot_info.nr_nodes; j++)
+        {
+            if (boot_info.node_distance[i][j] == 0)
+                boot_info.node_distance[i][j] = i == j ? 10 : 20;
+        }
+    }
+
+    for (uint64_t i = 0; i < boot_info.nr_mem; i++)
+    {
+        printk("memory: [%lx, %lx) node %d\n", boot_info.mem[i].base, boot_info.mem[i].base + boot_info.mem[i].size, boot_info.mem[i].node);
+    }
+    printk("harts: %d, timebase: %d Hz, virtio-mmio: %d, hwcap: %lx\n", boot_info.nr_harts, boot_info.timebase_freq, boot_info.nr_virtio, boot_info.hwcap);
+    printk("...fdt_init done!\n");
+}
+
+uint64_t mem_end(void)
+{
+    struct mem_range *last = &boot_info.mem[boot_info.nr_mem - 1];
+    return last->base + last->size;
+}
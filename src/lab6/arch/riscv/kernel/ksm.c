@@ -0,0 +1,328 @@
+#include "ksm.h"
+#include "defs.h"
+#include "mm.h"
+#include "vm.h"
+#include "proc.h"
+#include "string.h"
+
+uint64_t ksm_scan_interval = KSM_SCAN_INTERVAL;
+uint64_t ksm_pages_to_scan = KSM_PAGES_TO_SCAN;
+struct ksm_stat ksm_stat;
+static uint64_t ksm_ticks;
+
+/*
+ * 每个物理页上一次被扫描时的校验和：两轮之间内容不变的页才参与合并，经常被写的页合并之后马上又会被 COW 拆开。
+ * merged 标记扫描器合并出来的页，gen 是最后一次扫描到它的轮数，一整轮都没有扫描到的合并页不再计入统计。
+ * 合并过的页通过 next 串成链表，每轮结束时只遍历链表统计，不用扫描整个物理内存。
+ */
+struct ksm_page
+{
+    uint32_t checksum;
+    uint16_t gen;
+    uint8_t merged;
+    uint8_t listed; // 在 merged_list 上
+    uint32_t next;  // 链表中下一页的 pfn + 1，0 表示结束
+};
+
+static struct ksm_page *ksm_pages;
+static uint32_t merged_list; // 链表头，同样是 pfn + 1
+
+/*
+ * 本轮扫描到的候选页，按校验和放入哈希表，每一轮开始时清空。
+ * 表项只记录页在哪个进程的哪个地址，使用前重新查页表确认仍然这样映射着。
+ */
+struct ksm_item
+{
+    uint32_t checksum;
+    uint32_t next; // 同一个桶中的下一项的下标 + 1，0 表示结束
+    uint64_t pid;
+    uint64_t va;
+    uint64_t pfn;
+};
+
+#define KSM_NR_BUCKETS (PGSIZE / sizeof(uint32_t))
+#define KSM_ITEM_PAGES 8
+#define KSM_MAX_ITEMS (KSM_ITEM_PAGES * PGSIZE / sizeof(struct ksm_item))
+
+static uint32_t *ksm_buckets;
+static struct ksm_item *ksm_items;
+static uint64_t nr_ksm_items;
+static uint32_t zero_checksum;
+
+// 扫描位置：下一个要扫描的进程和地址
+static uint64_t scan_pid = 1, scan_va;
+static int tlb_dirty;
+
+static uint32_t ksm_checksum(void *page)
+{
+    uint64_t *p = (uint64_t *)page;
+    uint64_t h = 0xcbf29ce484222325UL;
+    for (uint64_t i = 0; i < PGSIZE / sizeof(uint64_t); i++)
+        h = (h ^ p[i]) * 0x100000001b3UL;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+void ksm_init(void)
+{
+    uint64_t size = PGROUNDUP(buddy_total_pages() * sizeof(struct ksm_page));
+    ksm_pages = (struct ksm_page *)alloc_pages(size / PGSIZE);
+    ksm_buckets = (uint32_t *)alloc_page();
+    ksm_items = (struct ksm_item *)alloc_pages(KSM_ITEM_PAGES);
+    if (!ksm_pages || !ksm_buckets || !ksm_items)
+    {
+        ksm_pages = NULL;
+        return;
+    }
+    memset(ksm_pages, 0, size);
+    memset(ksm_buckets, 0, PGSIZE);
+    zero_checksum = ksm_checksum(zero_page);
+}
+
+int page_ksm(void *page)
+{
+    return ksm_pages && ksm_pages[PHYS2PFN(VA2PA((uint64_t)page))].merged;
+}
+
+// 标记为合并页，不在链表上时加入链表
+static void ksm_mark_merged(uint64_t pfn)
+{
+    struct ksm_page *kp = &ksm_pages[pfn];
+    kp->merged = 1;
+    kp->gen = (uint16_t)ksm_stat.full_scans;
+    if (kp->listed)
+        return;
+    kp->listed = 1;
+    kp->next = merged_list;
+    merged_list = pfn + 1;
+}
+
+void ksm_migrate_page(void *old_page, void *new_page)
+{
+    if (!ksm_pages)
+        return;
+    struct ksm_page *old_kp = &ksm_pages[PHYS2PFN(VA2PA((uint64_t)old_page))];
+    uint64_t new_pfn = PHYS2PFN(VA2PA((uint64_t)new_page));
+    ksm_pages[new_pfn].merged = 0;
+    // 旧页留在链表上，本轮结束时摘下
+    if (old_kp->merged)
+        ksm_mark_merged(new_pfn);
+    ksm_pages[new_pfn].checksum = old_kp->checksum;
+    ksm_pages[new_pfn].gen = old_kp->gen;
+    old_kp->merged = 0;
+}
+
+// 只合并私有的匿名页，MAP_SHARED 的页写入时要被所有映射看到
+static int ksm_vma(struct vm_area_struct *vma)
+{
+    return (vma->vm_flags & VM_ANON) && !(vma->vm_flags & VM_SHARED);
+}
+
+/*
+ * 返回 va 的末级页表项，*next 为之后要扫描的地址。
+ * 没有末级页表时整段跳过；大页和被 fork 共享的末级页表不处理，修改它们会影响其他地址空间。
+ */
+static uint64_t *ksm_find_pte(uint64_t *pgtbl, uint64_t va, uint64_t *next)
+{
+    uint64_t pte2 = pgtbl[VA2VPN2(va)];
+    if (!PTE_IS_VALID(pte2))
+    {
+        *next = (va | ((1UL << 30) - 1)) + 1;
+        return NULL;
+    }
+    *next = HPGROUNDDOWN(va) + HPAGE_SIZE;
+    uint64_t pte1 = ((uint64_t *)PTE2VA(pte2))[VA2VPN1(va)];
+    if (!PTE_IS_VALID(pte1) || PTE_IS_LEAF(pte1) || get_page_refcnt((void *)PTE2VA(pte1)) > 1)
+        return NULL;
+    *next = va + PGSIZE;
+    return &((uint64_t *)PTE2VA(pte1))[VA2VPN0(va)];
+}
+
+// 页可以参与合并：可写的页只能被这一个页表项引用，否则内核的其他地方可能还持有它
+static int ksm_candidate(uint64_t pte)
+{
+    if (!PTE_IS_VALID(pte))
+        return 0;
+    void *page = (void *)PTE2VA(pte);
+    uint64_t refcnt = get_page_refcnt(page);
+    return page != zero_page && refcnt && (!(pte & PTE_W) || refcnt == 1);
+}
+
+// 表项记录的页仍然被同一个进程在同一个地址映射着，返回页表项
+static uint64_t *ksm_item_pte(struct ksm_item *item)
+{
+    struct task_struct *t = task[item->pid];
+    if (!t || t->state != TASK_RUNNING || !t->pgd)
+        return NULL;
+    struct vm_area_struct *vma = find_vma(&t->mm, item->va);
+    if (!vma || !ksm_vma(vma))
+        return NULL;
+    uint64_t next;
+    uint64_t *pte_p = ksm_find_pte(t->pgd, item->va, &next);
+    if (!pte_p || !ksm_candidate(*pte_p) || PHYS2PFN(PTE2PA(*pte_p)) != item->pfn)
+        return NULL;
+    return pte_p;
+}
+
+// 页表项改为只读地映射 kpage，原来的页少一个引用；TLB 在这一批扫描结束时统一刷新
+static void ksm_replace(uint64_t *pte_p, void *kpage)
+{
+    void *old_page = (void *)PTE2VA(*pte_p);
+    get_page(kpage);
+    *pte_p = (*pte_p & PTE_FLAGS_MASK & ~PTE_W) | VA2PTE((uint64_t)kpage);
+    put_page(old_page);
+    tlb_dirty = 1;
+    ksm_stat.merged++;
+}
+
+// 在哈希表中查找内容相同的页，找到时合并，返回 1
+static int ksm_merge(uint32_t checksum, uint64_t pid, uint64_t va, uint64_t *pte_p)
+{
+    void *page = (void *)PTE2VA(*pte_p);
+    uint64_t pfn = PHYS2PFN(PTE2PA(*pte_p));
+    for (uint32_t i = ksm_buckets[checksum % KSM_NR_BUCKETS]; i; i = ksm_items[i - 1].next)
+    {
+        struct ksm_item *item = &ksm_items[i - 1];
+        if (item->checksum != checksum)
+            continue;
+        // 同一个合并页的另一个映射
+        if (item->pfn == pfn)
+            return 1;
+        uint64_t *item_pte_p = ksm_item_pte(item);
+        if (!item_pte_p)
+            continue;
+        void *item_page = (void *)PTE2VA(*item_pte_p);
+        if (memcmp(item_page, page, PGSIZE) != 0)
+            continue;
+        // 保留已经合并过的页，另一边改为映射它
+        if (ksm_pages[pfn].merged && !ksm_pages[item->pfn].merged)
+        {
+            ksm_replace(item_pte_p, page);
+            item->pid = pid;
+            item->va = va;
+            item->pfn = pfn;
+        }
+        else
+        {
+            *item_pte_p &= ~PTE_W;
+            ksm_replace(pte_p, item_page);
+        }
+        ksm_mark_merged(item->pfn);
+        return 1;
+    }
+    if (nr_ksm_items == KSM_MAX_ITEMS)
+        return 0;
+    struct ksm_item *item = &ksm_items[nr_ksm_items++];
+    item->checksum = checksum;
+    item->pid = pid;
+    item->va = va;
+    item->pfn = pfn;
+    item->next = ksm_buckets[checksum % KSM_NR_BUCKETS];
+    ksm_buckets[checksum % KSM_NR_BUCKETS] = nr_ksm_items;
+    return 0;
+}
+
+static void ksm_scan_page(uint64_t pid, uint64_t va, uint64_t *pte_p)
+{
+    if (!ksm_candidate(*pte_p))
+        return;
+    void *page = (void *)PTE2VA(*pte_p);
+    struct ksm_page *kp = &ksm_pages[PHYS2PFN(PTE2PA(*pte_p))];
+    // 合并页不会被可写地映射；可写说明它已经被 COW 拆开后独占，或是释放之后重新分配了
+    if (*pte_p & PTE_W)
+        kp->merged = 0;
+    kp->gen = (uint16_t)ksm_stat.full_scans;
+    uint32_t checksum = ksm_checksum(page);
+    if (!kp->merged)
+    {
+        if (checksum != kp->checksum)
+        {
+            kp->checksum = checksum;
+            return;
+        }
+        // 全零的页直接映射零页，写入时和读缺页映射的零页一样走 COW
+        if (checksum == zero_checksum && memcmp(page, zero_page, PGSIZE) == 0)
+        {
+            ksm_replace(pte_p, zero_page);
+            ksm_stat.zero_merged++;
+            return;
+        }
+    }
+    ksm_merge(checksum, pid, va, pte_p);
+}
+
+// 一轮扫描结束：统计仍然共享着的合并页，把不再是合并页的摘下链表，清空候选页
+static void ksm_end_pass(void)
+{
+    uint64_t shared = 0, sharing = 0;
+    uint32_t *link = &merged_list;
+    while (*link)
+    {
+        uint64_t pfn = *link - 1;
+        struct ksm_page *kp = &ksm_pages[pfn];
+        uint64_t refcnt = get_page_refcnt((void *)PA2VA(PFN2PHYS(pfn)));
+        if (!kp->merged || kp->gen != (uint16_t)ksm_stat.full_scans || refcnt == 0)
+        {
+            kp->merged = 0;
+            kp->listed = 0;
+            *link = kp->next;
+            continue;
+        }
+        if (refcnt > 1)
+        {
+            shared++;
+            sharing += refcnt - 1;
+        }
+        link = &kp->next;
+    }
+    ksm_stat.pages_shared = shared;
+    ksm_stat.pages_sharing = sharing;
+    ksm_stat.full_scans++;
+    memset(ksm_buckets, 0, PGSIZE);
+    nr_ksm_items = 0;
+}
+
+void ksm_tick(void)
+{
+    if (!ksm_scan_interval || !ksm_pages || ++ksm_ticks < ksm_scan_interval)
+        return;
+    ksm_ticks = 0;
+    uint64_t budget = ksm_pages_to_scan;
+    while (budget)
+    {
+        if (scan_pid == NR_TASKS)
+        {
+            ksm_end_pass();
+            scan_pid = 1;
+            scan_va = 0;
+            break;
+        }
+        struct task_struct *t = task[scan_pid];
+        struct vm_area_struct *vma = NULL;
+        // vfork 的父进程阻塞时 mm 在子进程那里
+        if (t && t->state == TASK_RUNNING && t->pgd)
+        {
+            for (vma = t->mm.mmap; vma && (vma->vm_end <= scan_va || !ksm_vma(vma)); vma = vma->vm_next)
+                ;
+        }
+        if (!vma)
+        {
+            scan_pid++;
+            scan_va = 0;
+            continue;
+        }
+        if (scan_va < vma->vm_start)
+            scan_va = vma->vm_start;
+        uint64_t next;
+        uint64_t *pte_p = ksm_find_pte(t->pgd, scan_va, &next);
+        if (pte_p)
+        {
+            ksm_scan_page(scan_pid, scan_va, pte_p);
+            budget--;
+        }
+        scan_va = next;
+    }
+    // 末级页表没有被共享，但 vfork 的父子进程共用页表、ASID 不同
+    if (tlb_dirty)
+        flush_tlb_all();
+    tlb_dirty = 0;
+}
@@ -2,6 +2,12 @@
 #include "defs.h"
 #include "string.h"
 #include "printk.h"
+#include "fdt.h"
+#include "swap.h"
+#include "pagecache.h"
+#include "wss.h"
+#include "compact.h"
+#include "ksm.h"
 
 extern char _ekernel[];
 
@@ -16,7 +22,12 @@ struct {
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 void *free_page_start = &_ekernel;
-struct buddy buddy;
+
+// 每个 NUMA 节点一个 buddy，管理节点内 [base, end) 的页；pfn 都是相对 PHY_START 的全局页号
+struct buddy buddies[FDT_MAX_NODES];
+struct numa_stat numa_stat[FDT_MAX_NODES];
+static uint64_t local_node;                  // 启动 hart 所在的节点
+static uint64_t node_order[FDT_MAX_NODES];   // 按到 local_node 的距离排序，分配时依次尝试
 
 static uint64_t fixsize(uint64_t size) {
     size --;
@@ -29,39 +40,157 @@ static uint64_t fixsize(uint64_t size) {
     return size + 1;
 }
 
-void buddy_init() {
-    uint64_t buddy_size = (uint64_t)PHY_SIZE / PGSIZE;
+static struct buddy *pfn_to_buddy(uint64_t pfn) {
+    for (uint64_t nid = 0; nid < boot_info.nr_nodes; nid++) {
+        if (pfn >= buddies[nid].base && pfn < buddies[nid].end)
+            return &buddies[nid];
+    }
+    return NULL;
+}
+
+int pfn_to_nid(uint64_t pfn) {
+    struct buddy *b = pfn_to_buddy(pfn);
+    return b ? b - buddies : -1;
+}
+
+uint64_t numa_node_id(void) {
+    return local_node;
+}
+
+// 将节点内 [start, end) 范围内的页（节点内的页号）标记为不可分配（不存在的内存），每次处理一个对齐的最大块
+static void buddy_reserve(struct buddy *b, uint64_t start, uint64_t end) {
+    while (start < end) {
+        uint64_t node_size = 1;
+        while (start % (node_size * 2) == 0 && start + node_size * 2 <= end && node_size * 2 <= b->size)
+            node_size *= 2;
+        uint64_t index = start / node_size + b->size / node_size - 1;
+        b->bitmap[index] = 0;
+        while (index) {
+            index = PARENT(index);
+            b->bitmap[index] =
+                MAX(b->bitmap[LEFT_LEAF(index)], b->bitmap[RIGHT_LEAF(index)]);
+        }
+        start += node_size;
+    }
+}
+
+// 在节点内分配，返回全局 pfn，失败返回 0（pfn 0 属于内核，不会被分配出去）
+static uint64_t node_alloc(struct buddy *b, uint64_t nrpages) {
+    uint64_t index = 0;
+    uint64_t node_size;
+    uint64_t pfn = 0;
+
+    if (nrpages <= 0)
+        nrpages = 1;
+    else if (!IS_POWER_OF_2(nrpages))
+        nrpages = fixsize(nrpages);
+
+    if (b->size == 0 || b->bitmap[index] < nrpages)
+        return 0;
 
-    if (!IS_POWER_OF_2(buddy_size))
-        buddy_size = fixsize(buddy_size);
+    for(node_size = b->size; node_size != nrpages; node_size /= 2 ) {
+        if (b->bitmap[LEFT_LEAF(index)] >= nrpages)
+            index = LEFT_LEAF(index);
+        else
+            index = RIGHT_LEAF(index);
+    }
 
-    buddy.size = buddy_size;
-    buddy.bitmap = free_page_start;
-    free_page_start += 2 * buddy.size * sizeof(*buddy.bitmap);
-    memset(buddy.bitmap, 0, 2 * buddy.size * sizeof(*buddy.bitmap));
+    b->bitmap[index] = 0;
+    pfn = (index + 1) * node_size - b->size;
+    b->ref_cnt[pfn] = 1;
 
-    buddy.ref_cnt = free_page_start;
-    free_page_start += buddy.size * sizeof(*buddy.ref_cnt);
-    memset(buddy.ref_cnt, 0, buddy.size * sizeof(*buddy.ref_cnt));
+    while (index) {
+        index = PARENT(index);
+        b->bitmap[index] =
+            MAX(b->bitmap[LEFT_LEAF(index)], b->bitmap[RIGHT_LEAF(index)]);
+    }
 
-    uint64_t node_size = buddy.size * 2;
-    for (uint64_t i = 0; i < 2 * buddy.size - 1; ++i) {
+    return b->base + pfn;
+}
+
+// 节点覆盖属于它的内存区间中最低到最高的地址，中间的空洞和补齐到 2 的幂之后多出的尾部都不能被分配
+static void buddy_node_init(uint64_t nid) {
+    struct buddy *b = &buddies[nid];
+    uint64_t start = 0, end = 0;
+    for (uint64_t i = 0; i < boot_info.nr_mem; ++i) {
+        if (boot_info.mem[i].node != nid)
+            continue;
+        if (end == 0)
+            start = boot_info.mem[i].base;
+        end = boot_info.mem[i].base + boot_info.mem[i].size;
+    }
+    if (end == 0)
+        return;
+    b->base = PHYS2PFN(start);
+    b->end = PHYS2PFN(end);
+    b->size = fixsize(b->end - b->base);
+
+    b->bitmap = free_page_start;
+    free_page_start += 2 * b->size * sizeof(*b->bitmap);
+    memset(b->bitmap, 0, 2 * b->size * sizeof(*b->bitmap));
+
+    b->ref_cnt = free_page_start;
+    free_page_start += b->size * sizeof(*b->ref_cnt);
+    memset(b->ref_cnt, 0, b->size * sizeof(*b->ref_cnt));
+
+    uint64_t node_size = b->size * 2;
+    for (uint64_t i = 0; i < 2 * b->size - 1; ++i) {
         if (IS_POWER_OF_2(i + 1))
             node_size /= 2;
-        buddy.bitmap[i] = node_size;
+        b->bitmap[i] = node_size;
+    }
+
+    uint64_t pfn = b->base;
+    for (uint64_t i = 0; i < boot_info.nr_mem; ++i) {
+        if (boot_info.mem[i].node != nid)
+            continue;
+        uint64_t range_start = PHYS2PFN(boot_info.mem[i].base);
+        if (range_start > pfn)
+            buddy_reserve(b, pfn - b->base, range_start - b->base);
+        if (PHYS2PFN(boot_info.mem[i].base + boot_info.mem[i].size) > pfn)
+            pfn = PHYS2PFN(boot_info.mem[i].base + boot_info.mem[i].size);
     }
+    buddy_reserve(b, pfn - b->base, b->size);
+}
+
+void buddy_init() {
+    for (uint64_t nid = 0; nid < boot_info.nr_nodes; ++nid)
+        buddy_node_init(nid);
 
+    // 内核镜像和 buddy 自身的数据结构逐页分配，永远不释放
+    struct buddy *b = pfn_to_buddy(0);
+    if (!b)
+        Err("no memory at PHY_START");
     for (uint64_t pfn = 0; (uint64_t)PFN2PHYS(pfn) < VA2PA((uint64_t)free_page_start); ++pfn) {
-        buddy_alloc(1);
+        node_alloc(b, 1);
+    }
+
+    // 分配顺序：先本地节点，再按距离由近到远
+    local_node = boot_info.hart_node[boot_info.boot_hart];
+    if (local_node >= boot_info.nr_nodes)
+        local_node = 0;
+    for (uint64_t i = 0; i < boot_info.nr_nodes; ++i)
+        node_order[i] = i;
+    for (uint64_t i = 0; i < boot_info.nr_nodes; ++i) {
+        for (uint64_t j = i + 1; j < boot_info.nr_nodes; ++j) {
+            uint64_t di = boot_info.node_distance[local_node][node_order[i]];
+            uint64_t dj = boot_info.node_distance[local_node][node_order[j]];
+            if (dj < di || (dj == di && node_order[j] == local_node)) {
+                uint64_t t = node_order[i];
+                node_order[i] = node_order[j];
+                node_order[j] = t;
+            }
+        }
     }
 
-    printk("...buddy_init done!\n");
+    printk("...buddy_init done! %d node(s), local node %d\n", boot_info.nr_nodes, local_node);
     return;
 }
 
 void buddy_free(uint64_t pfn) {
+    struct buddy *b = pfn_to_buddy(pfn);
     // if ref_cnt is not zero, do nothing
-    if (buddy.ref_cnt[pfn])
+    if (!b || b->ref_cnt[pfn - b->base])
     {
         return;
     }
@@ -69,75 +198,141 @@ void buddy_free(uint64_t pfn) {
     uint64_t left_longest, right_longest;
 
     node_size = 1;
-    index = pfn + buddy.size - 1;
+    index = pfn - b->base + b->size - 1;
 
-    for (; buddy.bitmap[index]; index = PARENT(index)) {
+    for (; b->bitmap[index]; index = PARENT(index)) {
         node_size *= 2;
         if (index == 0)
             break;
     }
 
-    buddy.bitmap[index] = node_size;
+    b->bitmap[index] = node_size;
 
     while (index) {
         index = PARENT(index);
         node_size *= 2;
 
-        left_longest = buddy.bitmap[LEFT_LEAF(index)];
-        right_longest = buddy.bitmap[RIGHT_LEAF(index)];
+        left_longest = b->bitmap[LEFT_LEAF(index)];
+        right_longest = b->bitmap[RIGHT_LEAF(index)];
 
         if (left_longest + right_longest == node_size)
-            buddy.bitmap[index] = node_size;
+            b->bitmap[index] = node_size;
         else
-            buddy.bitmap[index] = MAX(left_longest, right_longest);
+            b->bitmap[index] = MAX(left_longest, right_longest);
     }
 }
 
 uint64_t buddy_alloc(uint64_t nrpages) {
-    uint64_t index = 0;
-    uint64_t node_size;
-    uint64_t pfn = 0;
-
-    if (nrpages <= 0)
-        nrpages = 1;
-    else if (!IS_POWER_OF_2(nrpages))
-        nrpages = fixsize(nrpages);
+    for (uint64_t i = 0; i < boot_info.nr_nodes; ++i) {
+        uint64_t nid = node_order[i];
+        uint64_t pfn = node_alloc(&buddies[nid], nrpages);
+        if (pfn == 0)
+            continue;
+        if (nid == local_node) {
+            numa_stat[nid].hit++;
+        } else {
+            numa_stat[nid].miss++;
+            numa_stat[local_node].foreign++;
+        }
+        return pfn;
+    }
+    return 0;
+}
 
-    if (buddy.bitmap[index] < nrpages)
-        return 0;
+/*
+ * 将一个已分配的 nrpages 页的块拆分为 nrpages 个独立分配的单页：
+ * 把块在 buddy 树中的所有子节点标记为已分配，之后每个页可以单独 buddy_free，
+ * 全部释放后会自动合并回大块。每个页继承块首页的引用计数。
+ */
+void split_pages(void *va, uint64_t nrpages) {
+    uint64_t pfn = PHYS2PFN(VA2PA((uint64_t)va));
+    struct buddy *b = pfn_to_buddy(pfn);
+    pfn -= b->base;
+    for (uint64_t node_size = nrpages / 2; node_size >= 1; node_size /= 2) {
+        uint64_t first = pfn / node_size + b->size / node_size - 1;
+        for (uint64_t i = 0; i < nrpages / node_size; ++i)
+            b->bitmap[first + i] = 0;
+    }
+    for (uint64_t i = 1; i < nrpages; ++i)
+        b->ref_cnt[pfn + i] = b->ref_cnt[pfn];
+}
 
-    for(node_size = buddy.size; node_size != nrpages; node_size /= 2 ) {
-        if (buddy.bitmap[LEFT_LEAF(index)] >= nrpages)
-            index = LEFT_LEAF(index);
-        else
-            index = RIGHT_LEAF(index);
+static void node_free_blocks(struct buddy *b, uint64_t *nr_blocks, uint64_t max_order) {
+    if (b->size == 0)   // 只有 cpu、没有内存的节点
+        return;
+    uint64_t node_size = b->size * 2;
+    for (uint64_t i = 0; i < 2 * b->size - 1; ++i) {
+        if (IS_POWER_OF_2(i + 1))
+            node_size /= 2;
+        if (b->bitmap[i] != node_size)
+            continue;
+        // 父节点整体空闲时，该块属于更大的空闲块
+        if (i && b->bitmap[PARENT(i)] == node_size * 2)
+            continue;
+        uint64_t order = 0;
+        while ((1UL << order) < node_size)
+            order++;
+        nr_blocks[order < max_order ? order : max_order]++;
     }
+}
 
-    buddy.bitmap[index] = 0;
-    pfn = (index + 1) * node_size - buddy.size;
-    buddy.ref_cnt[pfn] = 1;
+// 统计各阶（2^order 页）的空闲块数量，阶数大于 max_order 的计入 max_order
+void buddy_free_blocks(uint64_t *nr_blocks, uint64_t max_order) {
+    for (uint64_t nid = 0; nid < boot_info.nr_nodes; ++nid)
+        node_free_blocks(&buddies[nid], nr_blocks, max_order);
+}
 
-    while (index) {
-        index = PARENT(index);
-        buddy.bitmap[index] =
-            MAX(buddy.bitmap[LEFT_LEAF(index)], buddy.bitmap[RIGHT_LEAF(index)]);
+uint64_t buddy_node_free_pages(uint64_t nid) {
+    uint64_t nr_blocks[64] = {0};
+    uint64_t free = 0;
+    node_free_blocks(&buddies[nid], nr_blocks, 63);
+    for (uint64_t order = 0; order < 64; ++order)
+        free += nr_blocks[order] << order;
+    return free;
+}
+
+// pfn 是否空闲：从根向下找到第一个整块空闲或者整块已分配的节点，更深的节点可能是分配前留下的旧值
+int buddy_page_free(uint64_t pfn) {
+    struct buddy *b = pfn_to_buddy(pfn);
+    if (!b)
+        return 0;
+    pfn -= b->base;
+    uint64_t index = 0, node_size = b->size;
+    while (1) {
+        if (b->bitmap[index] == node_size)
+            return 1;
+        if (b->bitmap[index] == 0 || node_size == 1)
+            return 0;
+        node_size /= 2;
+        index = (pfn / node_size) % 2 ? RIGHT_LEAF(index) : LEFT_LEAF(index);
     }
+}
 
-    return pfn;
+// 所有节点覆盖的 pfn 范围 [0, buddy_total_pages())，节点之间可能有空洞
+uint64_t buddy_total_pages() {
+    uint64_t end = 0;
+    for (uint64_t nid = 0; nid < boot_info.nr_nodes; ++nid) {
+        if (buddies[nid].end > end)
+            end = buddies[nid].end;
+    }
+    return end;
 }
 
 void page_ref_inc(uint64_t pfn)
 {
-    buddy.ref_cnt[pfn]++;
+    struct buddy *b = pfn_to_buddy(pfn);
+    b->ref_cnt[pfn - b->base]++;
 }
 
 void page_ref_dec(uint64_t pfn)
 {
-    if (buddy.ref_cnt[pfn] > 0)
+    struct buddy *b = pfn_to_buddy(pfn);
+    uint64_t *ref_cnt = &b->ref_cnt[pfn - b->base];
+    if (*ref_cnt > 0)
     {
-        buddy.ref_cnt[pfn]--;
+        (*ref_cnt)--;
     }
-    if (buddy.ref_cnt[pfn] == 0)
+    if (*ref_cnt == 0)
     {
         Log("free page: %p", PFN2PHYS(pfn));
         buddy_free(pfn);
@@ -146,6 +341,12 @@ void page_ref_dec(uint64_t pfn)
 
 void *alloc_pages(uint64_t nrpages) {
     uint64_t pfn = buddy_alloc(nrpages);
+    // 内存不足时先回收只被页缓存引用的文件页，再换出冷的匿名页，然后重试；回收的页不连续，只对单页分配有效
+    while (pfn == 0 && nrpages == 1 && (page_cache_shrink(1) || swap_out(1)))
+        pfn = buddy_alloc(nrpages);
+    // 多页分配失败时整理内存，把可移动的页迁走，拼出连续的空闲块
+    if (pfn == 0 && nrpages > 1 && compact_memory(nrpages))
+        pfn = buddy_alloc(nrpages);
     if (pfn == 0)
         return 0;
     return (void *)(PA2VA(PFN2PHYS(pfn)));
@@ -155,6 +356,14 @@ void *alloc_page() {
     return alloc_pages(1);
 }
 
+// 分配一个 2 MiB 对齐的大页，并拆分为 HPAGE_NR 个单页，引用计数按 4 KiB 页管理
+void *alloc_huge_page() {
+    void *va = alloc_pages(HPAGE_NR);
+    if (va)
+        split_pages(va, HPAGE_NR);
+    return va;
+}
+
 void free_pages(void *va) {
     buddy_free(PHYS2PFN(VA2PA((uint64_t)va)));
 }
@@ -193,9 +402,16 @@ void kfreerange(char *start, char *end) {
     }
 }
 
+void *zero_page;
+
 void mm_init(void) {
     // kfreerange(_ekernel, (char *)PHY_END+PA2VA_OFFSET);
     buddy_init();
+    zero_page = alloc_page();
+    memset(zero_page, 0, PGSIZE);
+    page_cache_init();
+    wss_init();
+    ksm_init();
     printk("...mm_init done!\n");
 }
 
@@ -203,7 +419,7 @@ uint64_t get_page(void *va)
 {
     uint64_t pfn = PHYS2PFN(VA2PA((uint64_t)va));
     // check if the page is already allocated
-    if (buddy.ref_cnt[pfn] == 0)
+    if (get_page_refcnt(va) == 0)
     {
         return 1;
     }
@@ -214,7 +430,8 @@ uint64_t get_page(void *va)
 uint64_t get_page_refcnt(void *va)
 {
     uint64_t pfn = PHYS2PFN(VA2PA((uint64_t)va));
-    return buddy.ref_cnt[pfn];
+    struct buddy *b = pfn_to_buddy(pfn);
+    return b ? b->ref_cnt[pfn - b->base] : 0;
 }
 
 void put_page(void *va)
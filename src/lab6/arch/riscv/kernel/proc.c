@@ -7,6 +7,10 @@
 #include "vm.h"
 #include "elf.h"
 #include "fs.h"
+#include "vector.h"
+#include "ramfs.h"
+#include "wss.h"
+#include "ksm.h"
 
 #define print_task(action, task)                              \
     printk(action " [PID = %d PRIORITY = %d COUNTER = %d]\n", \
@@ -22,6 +26,7 @@ struct task_struct *task[NR_TASKS]; // 线程数组，所有的线程都保存
 uint64_t nr_tasks;
 
 extern void __switch_to(struct task_struct *prev, struct task_struct *next);
+static void task_free(struct task_struct *t);
 
 void switch_to(struct task_struct *next)
 {
@@ -51,11 +56,16 @@ void switch_to(struct task_struct *next)
     printk("sscratch: %p\n", next->thread.sscratch);
     printk("pgd: %p\n", next->pgd);
 #endif
+    vector_switch(prev, next);
+    switch_mm(next);
     __switch_to(prev, next);
 }
 
 void do_timer()
 {
+    current->cpu_time++;
+    wss_tick();
+    ksm_tick();
     //  1. 如果当前线程是 idle 线程或当前线程时间片耗尽则直接进行调度
     if (!(current == idle || current->counter == 0))
     {
@@ -69,18 +79,41 @@ void do_timer()
     schedule();
 }
 
+// 回收已经退出的进程的 task_struct。当前进程还在自己的内核栈上运行，留到下一次
+static void reap_dead_tasks(void)
+{
+    for (uint64_t pid = 1; pid < NR_TASKS; pid++)
+    {
+        if (task[pid] && task[pid]->state == TASK_DEAD && task[pid] != current)
+            task_free(task[pid]);
+    }
+}
+
+int64_t alloc_pid(void)
+{
+    reap_dead_tasks();
+    for (uint64_t pid = 1; pid < NR_TASKS; pid++)
+    {
+        if (!task[pid])
+            return pid;
+    }
+    return -1;
+}
+
 void schedule()
 {
 #ifdef DEBUG
     Log("schedule");
 #endif
-    uint64_t i, next, c;
+    uint64_t i, next, c, runnable;
     struct task_struct **p;
 
+    reap_dead_tasks();
     while (1)
     {
         c = 0;
         next = 0;
+        runnable = 0;
         i = NR_TASKS;
         p = &task[NR_TASKS];
         while (--i)
@@ -88,10 +121,13 @@ void schedule()
             if (!*--p)
                 continue;
             // find the task with the highest priority
+            if ((*p)->state == TASK_RUNNING)
+                runnable = 1;
             if ((*p)->state == TASK_RUNNING && (*p)->counter > c)
                 c = (*p)->counter, next = i;
         }
-        if (c)
+        // 没有可以运行的进程时运行 idle
+        if (c || !runnable)
             break;
         // all tasks have run out of time, set to priority
         for (p = &LAST_TASK; p > &FIRST_TASK; --p)
@@ -136,6 +172,308 @@ void load_program(struct task_struct *task)
     task->thread.sepc = ehdr->e_entry;
 }
 
+// ELF 头和程序头的检查：64 位 RISC-V 可执行文件，PT_LOAD 段按地址递增、互不重叠、文件偏移与地址按页对齐
+static int elf_check(Elf64_Ehdr *ehdr, Elf64_Phdr *phdrs)
+{
+    if (ehdr->e_ident[EI_MAG0] != ELFMAG0 || ehdr->e_ident[EI_MAG1] != ELFMAG1 || ehdr->e_ident[EI_MAG2] != ELFMAG2 || ehdr->e_ident[EI_MAG3] != ELFMAG3)
+        return -1;
+    if (ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_machine != EM_RISCV || ehdr->e_type != ET_EXEC)
+        return -1;
+    uint64_t prev_end = USER_START;
+    for (int i = 0; i < ehdr->e_phnum; ++i)
+    {
+        Elf64_Phdr *phdr = phdrs + i;
+        if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0)
+            continue;
+        if (phdr->p_filesz > phdr->p_memsz || phdr->p_offset % PGSIZE != phdr->p_vaddr % PGSIZE)
+            return -1;
+        if (PGROUNDDOWN(phdr->p_vaddr) < prev_end || phdr->p_vaddr + phdr->p_memsz > USER_END - STACK_LIMIT_MAX * PGSIZE)
+            return -1;
+        prev_end = PGROUNDUP(phdr->p_vaddr + phdr->p_memsz);
+    }
+    return 0;
+}
+
+int64_t load_elf(struct task_struct *task, struct file *file, uint64_t *entry)
+{
+    Elf64_Ehdr ehdr;
+    file->lseek(file, 0, SEEK_SET);
+    if (file->read(file, &ehdr, sizeof(ehdr)) != sizeof(ehdr))
+        return -1;
+    uint64_t phdrs_size = ehdr.e_phnum * sizeof(Elf64_Phdr);
+    if (ehdr.e_phentsize != sizeof(Elf64_Phdr) || phdrs_size > PGSIZE)
+        return -1;
+    Elf64_Phdr *phdrs = (Elf64_Phdr *)kalloc();
+    if (!phdrs)
+        return -1;
+    file->lseek(file, ehdr.e_phoff, SEEK_SET);
+    if (file->read(file, phdrs, phdrs_size) != phdrs_size || elf_check(&ehdr, phdrs) != 0)
+    {
+        put_page(phdrs);
+        return -1;
+    }
+
+    // vfork 的子进程要换上自己的空页表，在放弃借来的地址空间之前分配好
+    uint64_t *pgd = NULL;
+    if (task->vfork_parent && !(pgd = sv39_pg_dir_dup(swapper_pg_dir)))
+    {
+        put_page(phdrs);
+        return -1;
+    }
+
+    // 检查通过，从这里开始放弃旧的地址空间；之后只会因为内存不足失败，见最后的处理
+    if (task->vfork_parent)
+    {
+        // vfork 的子进程把借来的地址空间还给父进程
+        vfork_release(task);
+        task->pgd = pgd;
+    }
+    // 释放旧的地址空间；exit_mmap 不需要分配内存
+    exit_mmap(&task->mm, task->pgd);
+    mm_struct_init(&task->mm, task->mm.asid);
+    int64_t ret = 0;
+    for (int i = 0; i < ehdr.e_phnum; ++i)
+    {
+        Elf64_Phdr *phdr = phdrs + i;
+        if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0)
+            continue;
+        uint64_t vma_flags = ((phdr->p_flags & PF_X) ? VM_EXEC : 0) | ((phdr->p_flags & PF_W) ? VM_WRITE : 0) | ((phdr->p_flags & PF_R) ? VM_READ : 0);
+        uint64_t vma_start = PGROUNDDOWN(phdr->p_vaddr);
+        uint64_t vma_start_offset = phdr->p_vaddr - vma_start;
+        uint64_t vma_end = PGROUNDUP(phdr->p_vaddr + phdr->p_memsz);
+        // 段的内容不拷贝，缺页时经过页缓存读入
+        struct file *copy = vma_file_dup(file);
+        if (!copy || do_mmap(&task->mm, vma_start, vma_end - vma_start, phdr->p_offset - vma_start_offset, phdr->p_filesz + vma_start_offset, vma_flags) != vma_start)
+        {
+            if (copy)
+                put_page(copy);
+            ret = -1;
+            break;
+        }
+        find_vma(&task->mm, vma_start)->vm_file = copy;
+    }
+    if (ret == 0 && do_mmap(&task->mm, USER_END - PGSIZE, PGSIZE, 0, 0, VM_READ | VM_WRITE | VM_ANON | VM_GROWSDOWN) != USER_END - PGSIZE)
+        ret = -1;
+    put_page(phdrs);
+    // 旧的地址空间已经释放，execve 无法回到原来的程序，只能结束进程；spawn 的新进程由调用者回收
+    if (ret != 0 && task == current)
+        do_exit(-1);
+    *entry = ehdr.e_entry;
+    return ret;
+}
+
+void vfork_release(struct task_struct *child)
+{
+    struct task_struct *parent = child->vfork_parent;
+    // 子进程期间对地址空间的修改（mmap、munmap 等）都留给父进程；VMA 指回父进程的 mm
+    parent->mm = child->mm;
+    for (struct vm_area_struct *vma = parent->mm.mmap; vma; vma = vma->vm_next)
+        vma->vm_mm = &parent->mm;
+    parent->state = TASK_RUNNING;
+    child->vfork_parent = NULL;
+    mm_struct_init(&child->mm, child->pid);
+    child->pgd = NULL;
+}
+
+// 释放 t 仍然持有的页表、文件表和向量寄存器状态，最后释放 task_struct
+static void task_free(struct task_struct *t)
+{
+    if (t->pgd)
+    {
+        exit_mmap(&t->mm, t->pgd);
+        put_page(t->pgd);
+    }
+    if (t->files)
+        put_page(t->files);
+    vector_exit(t);
+    task[t->pid] = NULL;
+    put_page(t);
+}
+
+void do_exit(int64_t status)
+{
+    struct task_struct *t = current;
+    printk("[PID = %d] exited with status %d\n", t->pid, status);
+    if (t->vfork_parent)
+        vfork_release(t);
+    // 在内核页表下释放用户地址空间，task_struct 和内核栈留到切换走之后再回收
+    switch_mm(idle);
+    if (t->pgd)
+    {
+        exit_mmap(&t->mm, t->pgd);
+        put_page(t->pgd);
+        t->pgd = NULL;
+    }
+    put_page(t->files);
+    t->files = NULL;
+    t->state = TASK_DEAD;
+    nr_tasks--;
+    schedule();
+}
+
+// 创建一个将要运行用户程序的进程，还没有加载程序；files 不为 NULL 时与之共享文件表
+static struct task_struct *task_create(uint64_t pid, uint64_t priority, struct files_struct *files)
+{
+    struct task_struct *t = task[pid] = (struct task_struct *)kalloc();
+    // 2. 其中每个线程的 state 为 TASK_RUNNING, 此外，counter 和 priority 进行如下赋值：
+    t->state = TASK_RUNNING;
+    //     - counter  = 0;
+    t->counter = 0;
+    t->priority = priority;
+    t->pid = pid;
+    t->cpu_time = 0;
+    memset(&t->faults, 0, sizeof(t->faults));
+    memset(&t->wss, 0, sizeof(t->wss));
+    t->vstate = NULL;
+    t->vfork_parent = NULL;
+    mm_struct_init(&t->mm, pid);
+    // pid 可能是重用的，清掉旧进程留在这个 ASID 下的 TLB 项
+    flush_tlb_mm(&t->mm);
+    // 3. 为 task[1] ~ task[NR_TASKS - 1] 设置 thread_struct 中的 ra 和 sp
+    //     - ra 设置为 __dummy（见 4.2.2）的地址
+    t->thread.ra = (uint64_t)__dummy;
+    //     - sp 设置为该线程申请的物理页的高地址
+    t->thread.sp = (uint64_t)t + PGSIZE;
+    // 配置 sstatus 中的 SPP（使得 sret 返回至 U-Mode）、SPIE（sret 之后开启中断）、SUM（S-Mode 可以访问 User 页面）
+    t->thread.sstatus = SPIE | SUM;
+    // 用户程序和内核的 memcpy / memset 可能使用向量寄存器，需要在每个线程中打开 sstatus.VS
+    if (has_vector)
+        t->thread.sstatus |= SSTATUS_VS_INITIAL;
+    // 将 sscratch 设置为 U-Mode 的 sp，其值为 USER_END（将用户态栈放置在 user space 的最后一个页面）
+    t->thread.sscratch = USER_END;
+    // 为了避免 U-Mode 和 S-Mode 切换的时候切换页表，我们将内核页表 swapper_pg_dir 复制到每个进程的页表中
+    t->pgd = sv39_pg_dir_dup(swapper_pg_dir);
+    //这个函数需要大家在 proc.c 中的 task_init 函数中为每个进程调用，创建文件表并保存在 task struct 中。
+    if (files)
+    {
+        get_page(files);
+        t->files = files;
+    }
+    else
+        t->files = (struct files_struct *)file_init();
+    return t;
+}
+
+int64_t do_spawn(const char *path, uint64_t priority, struct files_struct *files)
+{
+    struct file file;
+    // 只有提供 get_page 的文件系统能按需映射程序
+    if (file_open(&file, path, FILE_READABLE) != 0 || !file.get_page)
+        return -1;
+    int64_t pid = alloc_pid();
+    if (pid < 0)
+        return -1;
+    struct task_struct *t = task_create(pid, priority, files);
+    uint64_t entry;
+    if (!t->pgd || load_elf(t, &file, &entry) != 0)
+    {
+        task_free(t);
+        return -1;
+    }
+    t->thread.sepc = entry;
+    nr_tasks++;
+#ifdef DEBUG
+    print_task("SET", t);
+#endif
+    return pid;
+}
+
+// _sramdisk 中只有一个程序（ELF 或者纯二进制）时，启动一个进程运行它
+static void start_uapp(void)
+{
+    //     - priority = rand() 产生的随机数（控制范围在 [PRIORITY_MIN, PRIORITY_MAX] 之间）
+    struct task_struct *t = task_create(1, PRIORITY_MIN + rand() % (PRIORITY_MAX - PRIORITY_MIN + 1), NULL);
+    // 二进制文件需要先被拷贝到一块新的、供某个进程专用的内存之后再进行映射，来防止所有的进程共享数据，造成预期外的进程间相互影响。
+    // test if _sramdisk is elf file
+    Elf64_Ehdr *ehdr = (Elf64_Ehdr *)_sramdisk;
+    if (ehdr->e_ident[EI_MAG0] == ELFMAG0 && ehdr->e_ident[EI_MAG1] == ELFMAG1 && ehdr->e_ident[EI_MAG2] == ELFMAG2 && ehdr->e_ident[EI_MAG3] == ELFMAG3)
+    {
+#ifdef DEBUG
+        printk("load program\n");
+#endif
+        load_program(t);
+        t->thread.sepc = ehdr->e_entry;
+#ifdef DEBUG
+        printk("e_entry: %p\n", ehdr->e_entry);
+#endif
+    }
+    else
+    {
+#ifdef DEBUG
+        printk("load binary\n");
+#endif
+        do_mmap(&t->mm, (uint64_t)_sramdisk, (uint64_t)_eramdisk - (uint64_t)_sramdisk, 0, 0, VM_READ | VM_WRITE | VM_EXEC); // to be checked
+        // 将 sepc 设置为 USER_START
+        t->thread.sepc = USER_START;
+    }
+#ifdef DEBUG
+    printk("load done\n");
+#endif
+    // 用户态栈：我们可以申请一个空的页面来作为用户态栈，并映射到进程的页表中
+    // 栈在下方缺页时自动向下扩展，见 find_extend_vma
+    do_mmap(&t->mm, USER_END - PGSIZE, PGSIZE, 0, 0, VM_READ | VM_WRITE | VM_ANON | VM_GROWSDOWN);
+    nr_tasks = 1;
+#ifdef DEBUG
+    print_task("SET", t);
+#endif
+}
+
+/*
+ * _sramdisk 是 initramfs 时，按 RAMFS_MANIFEST 启动进程。每行为 "<路径> <优先级>"，
+ * 空行和以 '#' 开头的行被忽略，优先级缺省时随机选取。程序的页直接映射 initramfs 中的页。
+ */
+static void start_initramfs(void)
+{
+    struct file manifest;
+    if (file_open(&manifest, RAMFS_MANIFEST, FILE_READABLE) != 0)
+    {
+        printk(RED "no %s in initramfs\n" CLEAR, RAMFS_MANIFEST);
+        return;
+    }
+    char *buf = (char *)kalloc();
+    int64_t len = manifest.read(&manifest, buf, PGSIZE - 1);
+    buf[len < 0 ? 0 : len] = '\0';
+
+    char *line = buf;
+    while (*line)
+    {
+        char *next = line;
+        while (*next && *next != '\n')
+            next++;
+        if (*next)
+            *next++ = '\0';
+        char *path = line;
+        while (*path == ' ' || *path == '\t')
+            path++;
+        line = next;
+        if (*path == '\0' || *path == '#')
+            continue;
+        char *arg = path;
+        while (*arg && *arg != ' ' && *arg != '\t')
+            arg++;
+        uint64_t priority = 0;
+        if (*arg)
+        {
+            *arg++ = '\0';
+            while (*arg == ' ' || *arg == '\t')
+                arg++;
+            for (; *arg >= '0' && *arg <= '9'; arg++)
+                priority = priority * 10 + (*arg - '0');
+        }
+        if (priority < PRIORITY_MIN || priority > PRIORITY_MAX)
+            priority = PRIORITY_MIN + rand() % (PRIORITY_MAX - PRIORITY_MIN + 1);
+
+        int64_t pid = do_spawn(path, priority, NULL);
+        if (pid < 0)
+        {
+            printk(RED "cannot start %s\n" CLEAR, path);
+            continue;
+        }
+        printk("start %s as [PID = %d] priority = %d\n", path, pid, priority);
+    }
+    put_page(buf);
+}
+
 void task_init()
 {
 #ifdef DEBUG
@@ -152,6 +490,13 @@ void task_init()
     idle->priority = 0;
     // 4. 设置 idle 的 pid 为 0
     idle->pid = 0;
+    idle->cpu_time = 0;
+    memset(&idle->faults, 0, sizeof(idle->faults));
+    memset(&idle->wss, 0, sizeof(idle->wss));
+    idle->vstate = NULL;
+    idle->vfork_parent = NULL;
+    idle->pgd = swapper_pg_dir;
+    mm_struct_init(&idle->mm, 0);
     // 5. 将 current 和 task[0] 指向 idle
     current = idle;
     task[0] = idle;
@@ -159,66 +504,14 @@ void task_init()
     print_task("SET", idle);
 #endif
 
-    nr_tasks = 1;
+    nr_tasks = 0;
 
-    // 1. 参考 idle 的设置，为 task[1] ~ task[NR_TASKS - 1] 进行初始化
-    for (int i = 1; i < 2; i++)
-    {
-        task[i] = (struct task_struct *)kalloc();
-        // 2. 其中每个线程的 state 为 TASK_RUNNING, 此外，counter 和 priority 进行如下赋值：
-        task[i]->state = TASK_RUNNING;
-        //     - counter  = 0;
-        task[i]->counter = 0;
-        //     - priority = rand() 产生的随机数（控制范围在 [PRIORITY_MIN, PRIORITY_MAX] 之间）
-        task[i]->priority = PRIORITY_MIN + rand() % (PRIORITY_MAX - PRIORITY_MIN + 1);
-        task[i]->pid = i;
-        // 3. 为 task[1] ~ task[NR_TASKS - 1] 设置 thread_struct 中的 ra 和 sp
-        //     - ra 设置为 __dummy（见 4.2.2）的地址
-        task[i]->thread.ra = (uint64_t)__dummy;
-        //     - sp 设置为该线程申请的物理页的高地址
-        task[i]->thread.sp = (uint64_t)task[i] + PGSIZE;
-        // 配置 sstatus 中的 SPP（使得 sret 返回至 U-Mode）、SPIE（sret 之后开启中断）、SUM（S-Mode 可以访问 User 页面）
-        task[i]->thread.sstatus = SPIE | SUM;
-        // 将 sscratch 设置为 U-Mode 的 sp，其值为 USER_END（将用户态栈放置在 user space 的最后一个页面）
-        task[i]->thread.sscratch = USER_END;
-        // 为了避免 U-Mode 和 S-Mode 切换的时候切换页表，我们将内核页表 swapper_pg_dir 复制到每个进程的页表中
-        task[i]->pgd = sv39_pg_dir_dup(swapper_pg_dir);
-        // 二进制文件需要先被拷贝到一块新的、供某个进程专用的内存之后再进行映射，来防止所有的进程共享数据，造成预期外的进程间相互影响。
-        // test if _sramdisk is elf file
-        Elf64_Ehdr *ehdr = (Elf64_Ehdr *)_sramdisk;
-        if (ehdr->e_ident[EI_MAG0] == ELFMAG0 && ehdr->e_ident[EI_MAG1] == ELFMAG1 && ehdr->e_ident[EI_MAG2] == ELFMAG2 && ehdr->e_ident[EI_MAG3] == ELFMAG3)
-        {
-#ifdef DEBUG
-            printk("load program\n");
-#endif
-            load_program(task[i]);
-            task[i]->thread.sepc = ehdr->e_entry;
-#ifdef DEBUG
-            printk("e_entry: %p\n", ehdr->e_entry);
-#endif
-        }
-        else
-        {
-#ifdef DEBUG
-            printk("load binary\n");
-#endif
-            do_mmap(&task[i]->mm, (uint64_t)_sramdisk, (uint64_t)_eramdisk - (uint64_t)_sramdisk, 0, 0, VM_READ | VM_WRITE | VM_EXEC); // to be checked
-            // 将 sepc 设置为 USER_START
-            task[i]->thread.sepc = USER_START;
-        }
-#ifdef DEBUG
-        printk("load done\n");
-#endif
-        // 用户态栈：我们可以申请一个空的页面来作为用户态栈，并映射到进程的页表中
-        do_mmap(&task[i]->mm, USER_END - PGSIZE, PGSIZE, 0, 0, VM_READ | VM_WRITE | VM_ANON);
-        //这个函数需要大家在 proc.c 中的 task_init 函数中为每个进程调用，创建文件表并保存在 task struct 中。
-        task[i]->files = (struct files_struct *)file_init();
-#ifdef DEBUG
-        print_task("SET", task[i]);
-#endif
-    }
+    // 1. 参考 idle 的设置，为用户进程进行初始化
+    if (ramfs_present())
+        start_initramfs();
+    else
+        start_uapp();
 
-    /* YOUR CODE HERE */
     printk("...task_init done!\n");
 }
 
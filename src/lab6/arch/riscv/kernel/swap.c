@@ -0,0 +1,194 @@
+#include "swap.h"
+#include "defs.h"
+#include "mm.h"
+#include "vm.h"
+#include "proc.h"
+#include "virtio.h"
+#include "string.h"
+#include "printk.h"
+#include "wss.h"
+
+struct swap_info swap_info;
+
+// 换出扫描的位置：下一次从 task[scan_task] 的 scan_va 处继续
+static int scan_task = 1;
+static uint64_t scan_va;
+
+void swap_init(uint64_t lba, uint64_t sector_count)
+{
+    uint64_t nr_slots = sector_count / SECTORS_PER_PAGE;
+    if (nr_slots == 0)
+        return;
+    uint64_t map_pages = (nr_slots + PGSIZE - 1) / PGSIZE;
+    swap_info.swap_map = (uint8_t *)alloc_pages(map_pages);
+    if (!swap_info.swap_map)
+        return;
+    memset(swap_info.swap_map, 0, map_pages * PGSIZE);
+    swap_info.lba = lba;
+    swap_info.nr_slots = nr_slots;
+    swap_info.nr_free = nr_slots;
+    swap_info.cursor = 0;
+    printk("...swap init done, %d pages\n", nr_slots);
+}
+
+static uint64_t alloc_slot(void)
+{
+    for (uint64_t i = 0; i < swap_info.nr_slots; i++)
+    {
+        uint64_t slot = (swap_info.cursor + i) % swap_info.nr_slots;
+        if (swap_info.swap_map[slot] == 0)
+        {
+            swap_info.swap_map[slot] = 1;
+            swap_info.nr_free--;
+            swap_info.cursor = slot + 1;
+            return slot;
+        }
+    }
+    return -1;
+}
+
+static void swap_rw(uint64_t slot, void *page, int write)
+{
+    uint64_t sector = swap_info.lba + slot * SECTORS_PER_PAGE;
+    for (uint64_t i = 0; i < SECTORS_PER_PAGE; i++)
+    {
+        if (write)
+            virtio_blk_write_sector(sector + i, page + i * VIRTIO_BLK_SECTOR_SIZE);
+        else
+            virtio_blk_read_sector(sector + i, page + i * VIRTIO_BLK_SECTOR_SIZE);
+    }
+}
+
+void swap_dup(uint64_t pte)
+{
+    if (swap_info.swap_map[SWP_SLOT(pte)] < SWAP_MAP_MAX)
+        swap_info.swap_map[SWP_SLOT(pte)]++;
+}
+
+void swap_free(uint64_t pte)
+{
+    if (swap_info.swap_map[SWP_SLOT(pte)] == SWAP_MAP_MAX)
+        return;
+    if (--swap_info.swap_map[SWP_SLOT(pte)] == 0)
+        swap_info.nr_free++;
+}
+
+// 换出的页在刷新 TLB 之前不能释放，攒够 SWAP_BATCH 个或扫描结束时刷新一次再释放
+#define SWAP_BATCH 16
+
+struct swap_batch
+{
+    void *pages[SWAP_BATCH];
+    uint64_t nr;
+    int flush;  // 清除过 A 位或换出过页，需要刷新 TLB
+    int shared; // 其中有被 fork 出的多个地址空间共享的末级页表
+};
+
+static void swap_batch_flush(struct task_struct *t, struct swap_batch *batch)
+{
+    if (batch->shared)
+        flush_tlb_all();
+    else if (batch->flush)
+        flush_tlb_mm(&t->mm);
+    for (uint64_t i = 0; i < batch->nr; i++)
+        put_page(batch->pages[i]);
+    batch->nr = 0;
+    batch->flush = batch->shared = 0;
+}
+
+/*
+ * 在 task 的匿名 VMA 中换出最多 nrpages 个页（clock 算法）：
+ * PTE_A 置位的页说明最近被访问过，清除 A 位后跳过；PTE_A 为 0 的页写入 swap 分区并释放。
+ * 工作集扫描器会定期清除 A 位，它在最近一轮看到被访问过的页同样跳过。
+ * 被多个 PTE 共享的页（COW）和大页不换出。
+ */
+static uint64_t swap_out_task(struct task_struct *t, uint64_t nrpages)
+{
+    uint64_t freed = 0;
+    struct swap_batch batch;
+    batch.nr = 0;
+    batch.flush = batch.shared = 0;
+    for (struct vm_area_struct *vma = t->mm.mmap; vma && freed < nrpages && swap_info.nr_free; vma = vma->vm_next)
+    {
+        if (!(vma->vm_flags & VM_ANON) || vma->vm_end <= scan_va)
+            continue;
+        for (uint64_t va = vma->vm_start > scan_va ? vma->vm_start : scan_va; va < vma->vm_end; va += PGSIZE)
+        {
+            uint64_t *pte_p = find_pte(t->pgd, va);
+            if (!pte_p || !PTE_IS_VALID(*pte_p) || find_huge_pte(t->pgd, va))
+                continue;
+            void *page = (void *)PTE2VA(*pte_p);
+            if (get_page_refcnt(page) != 1)
+                continue;
+            // 末级页表可能被 fork 出的多个地址空间共享，它们的 TLB 也要刷新
+            int shared = get_page_refcnt((void *)PGROUNDDOWN((uint64_t)pte_p)) > 1;
+            if (*pte_p & PTE_A)
+            {
+                *pte_p &= ~PTE_A;
+                batch.flush = 1;
+                batch.shared |= shared;
+                continue;
+            }
+            if (page_recently_accessed(page))
+                continue;
+            uint64_t slot = alloc_slot();
+            if (slot == -1)
+                break;
+#ifdef DEBUG
+            Log("swap out pid %d va %lx -> slot %d", t->pid, va, slot);
+#endif
+            swap_rw(slot, page, 1);
+            *pte_p = SWP_ENTRY(slot);
+            batch.pages[batch.nr++] = page;
+            batch.flush = 1;
+            batch.shared |= shared;
+            if (batch.nr == SWAP_BATCH)
+                swap_batch_flush(t, &batch);
+            if (++freed == nrpages)
+            {
+                scan_va = va + PGSIZE;
+                break;
+            }
+        }
+    }
+    swap_batch_flush(t, &batch);
+    return freed;
+}
+
+// 内存不足时由 alloc_pages 调用，返回释放的页数
+uint64_t swap_out(uint64_t nrpages)
+{
+    uint64_t freed = 0;
+    if (swap_info.nr_free == 0)
+        return 0;
+    // 每个 task 最多扫描两遍：第一遍清除 A 位，第二遍换出
+    for (int visits = 0; visits <= 2 * (NR_TASKS - 1) && freed < nrpages && swap_info.nr_free; visits++)
+    {
+        struct task_struct *t = task[scan_task];
+        // vfork 的父进程阻塞时 mm 在子进程那里，由子进程扫描
+        if (t && t->pgd && t->state == TASK_RUNNING)
+            freed += swap_out_task(t, nrpages - freed);
+        if (freed < nrpages)
+        {
+            scan_task = scan_task % (NR_TASKS - 1) + 1;
+            scan_va = 0;
+        }
+    }
+    return freed;
+}
+
+// 缺页时把 swap entry 对应的页读回内存，以 perm 重新映射
+int swap_in(uint64_t *pte_p, uint64_t perm)
+{
+    uint64_t pte = *pte_p;
+    void *page = alloc_page();
+    if (!page)
+        return -1;
+#ifdef DEBUG
+    Log("swap in slot %d", SWP_SLOT(pte));
+#endif
+    swap_rw(SWP_SLOT(pte), page, 0);
+    *pte_p = PA2PTE(VA2PA((uint64_t)page)) | perm;
+    swap_free(pte);
+    return 0;
+}
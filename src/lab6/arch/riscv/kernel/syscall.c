@@ -5,15 +5,32 @@
 #include "proc.h"
 #include "mm.h"
 #include "string.h"
+#include "defs.h"
+#include "vm.h"
+#include "swap.h"
+#include "fdt.h"
+#include "vector.h"
+#include "errno.h"
 
-uint64_t do_fork(struct pt_regs *regs)
+// fork 和 vfork 共同的部分：复制 task_struct 和内核栈，子进程从 __ret_from_fork 返回用户态。地址空间由调用者处理
+static struct task_struct *copy_task(struct pt_regs *regs)
 {
-    uint64_t new_pid = ++nr_tasks;
+    int64_t new_pid = alloc_pid();
+    if (new_pid < 0)
+        return NULL;
     printk("[PID = %d] forked from [PID = %d]", new_pid, current->pid);
     // 将新进程加入调度队列
     struct task_struct *new_task = task[new_pid] = (struct task_struct *)alloc_page();
     memcpy(new_task, current, PGSIZE);
     new_task->pid = new_pid;
+    new_task->cpu_time = 0;
+    memset(&new_task->faults, 0, sizeof(new_task->faults));
+    memset(&new_task->wss, 0, sizeof(new_task->wss));
+    new_task->vfork_parent = NULL;
+    // 父子进程共享文件表
+    get_page(new_task->files);
+    nr_tasks++;
+    vector_fork(new_task);
     new_task->thread.ra = (uint64_t)__ret_from_fork;
 #ifdef DEBUG
     Log("old_task page = %lx", current);
@@ -27,9 +44,38 @@ uint64_t do_fork(struct pt_regs *regs)
     new_regs->sepc += 4;
     new_task->thread.sscratch = csr_read(sscratch);
     new_task->thread.sstatus = current->thread.sstatus;
-    new_task->mm.mmap = NULL;
+    return new_task;
+}
+
+// fork 失败时回收还没有运行过的子进程：已经复制的映射、页表、文件表的引用和 task_struct
+static void fork_abort(struct task_struct *child)
+{
+    if (child->pgd)
+    {
+        exit_mmap(&child->mm, child->pgd);
+        put_page(child->pgd);
+    }
+    put_page(child->files);
+    vector_exit(child);
+    task[child->pid] = NULL;
+    nr_tasks--;
+    put_page(child);
+}
+
+uint64_t do_fork(struct pt_regs *regs)
+{
+    struct task_struct *new_task = copy_task(regs);
+    if (!new_task)
+        return -1;
+    uint64_t new_pid = new_task->pid;
+    mm_struct_init(&new_task->mm, new_pid);
     // 拷贝内核页表 swapper_pg_dir
     new_task->pgd = sv39_pg_dir_dup(swapper_pg_dir);
+    if (!new_task->pgd)
+    {
+        fork_abort(new_task);
+        return -ENOMEM;
+    }
     // 遍历父进程 vma，并遍历父进程页表
     struct vm_area_struct *parent_vma = current->mm.mmap;
     while (parent_vma)
@@ -38,30 +84,24 @@ uint64_t do_fork(struct pt_regs *regs)
         Log("parent_vma: %lx %lx %lx %lx %lx", parent_vma->vm_start, parent_vma->vm_end, parent_vma->vm_pgoff, parent_vma->vm_filesz, parent_vma->vm_flags);
 #endif
         // 将这个 vma 也添加到新进程的 vma 链表中
-        do_mmap(&new_task->mm, parent_vma->vm_start, parent_vma->vm_end - parent_vma->vm_start, parent_vma->vm_pgoff, parent_vma->vm_filesz, parent_vma->vm_flags);
-        for (uint64_t parent_page = parent_vma->vm_start; parent_page < parent_vma->vm_end; parent_page += PGSIZE)
+        uint64_t start = parent_vma->vm_start;
+        int err = do_mmap(&new_task->mm, start, parent_vma->vm_end - start, parent_vma->vm_pgoff, parent_vma->vm_filesz, parent_vma->vm_flags) != start;
+        if (!err && parent_vma->vm_file)
+            err = !(find_vma(&new_task->mm, start)->vm_file = vma_file_dup(parent_vma->vm_file));
+        // MAP_SHARED：父子进程共享页面，保留写权限
+        uint64_t cow_mask = (parent_vma->vm_flags & VM_SHARED) ? ~0UL : ~(uint64_t)PTE_W;
+        if (err || copy_page_range(new_task->pgd, current->pgd, start, parent_vma->vm_end, cow_mask) != 0)
         {
-#ifdef DEBUG
-            Log("COW parent_page: %lx", parent_page);
-#endif
-            uint64_t *pte_p = find_pte(current->pgd, parent_page);
-            uint64_t pte = pte_p ? *pte_p : 0;
-            if (!pte)
-                continue;
-
-            // 将物理页的引用计数加一
-            uint64_t *parent_page_va = (uint64_t *)PTE2VA(pte);
-            get_page((void *)parent_page_va);
-            // 将父进程的该地址对应的页表项的 PTE_W 位置 0
-            *pte_p &= ~PTE_W;
-            pte = *pte_p; // 重新读取 pte
-            // 为子进程创建一个新的页表项，指向父进程的物理页，且权限不带 PTE_W
-            create_mapping(new_task->pgd, parent_page, VA2PA(PTE2VA(pte)), PGSIZE, pte & PTE_FLAGS_MASK);
+            // 父进程已经有页表项被去掉了写权限
+            flush_tlb_mm(&current->mm);
+            fork_abort(new_task);
+            return -ENOMEM;
         }
-        // flush TLB because we modifid page table in use
-        asm volatile("sfence.vma");
         parent_vma = parent_vma->vm_next;
     }
+    // 父进程的页表项被去掉了写权限，全部复制完之后刷新一次 TLB；子进程的 ASID 可能留有旧进程的 TLB 项
+    flush_tlb_mm(&current->mm);
+    flush_tlb_mm(&new_task->mm);
     // 处理父子进程的返回值
     // 父进程通过 do_fork 函数直接返回子进程的 pid，并回到自身运行
     // ：这里通过在 trap_handler 中设置返回值实现
@@ -69,6 +109,22 @@ uint64_t do_fork(struct pt_regs *regs)
     return new_pid;
 }
 
+/*
+ * vfork：子进程直接使用父进程的 mm 和页表（copy_task 已经原样复制），不复制任何页表项。
+ * 父进程阻塞，直到子进程 execve 或退出时通过 vfork_release 归还地址空间。
+ */
+uint64_t do_vfork(struct pt_regs *regs)
+{
+    struct task_struct *child = copy_task(regs);
+    if (!child)
+        return -1;
+    uint64_t pid = child->pid;
+    child->vfork_parent = current;
+    current->state = TASK_BLOCKED;
+    schedule();
+    return pid;
+}
+
 int64_t sys_write(uint64_t fd, const char *buf, uint64_t len)
 {
     int64_t ret;
@@ -189,6 +245,211 @@ int sys_close(int fd)
     return ret;
 }
 
+// 把用户态的路径拷贝到内核，过长时返回 -1
+static int copy_path(char *path, const char *pathname)
+{
+    uint64_t len = 0;
+    while (len < MAX_PATH_LENGTH - 1 && pathname[len])
+    {
+        path[len] = pathname[len];
+        len++;
+    }
+    if (pathname[len])
+        return -1;
+    path[len] = '\0';
+    return 0;
+}
+
+int64_t sys_execve(struct pt_regs *regs, const char *pathname)
+{
+    // 路径在旧的地址空间里，先拷贝出来
+    char path[MAX_PATH_LENGTH];
+    if (copy_path(path, pathname) != 0)
+        return -1;
+    Log("sys_execve %s", path);
+
+    struct file file;
+    uint32_t fs_type = get_fs_type(path);
+    if ((fs_type != FS_TYPE_FAT32 && fs_type != FS_TYPE_RAMFS) || file_open(&file, path, FILE_READABLE) != 0)
+        return -1;
+    uint64_t entry;
+    if (load_elf(current, &file, &entry) != 0)
+        return -1;
+    // vfork 的子进程换了一张新页表
+    switch_mm(current);
+    flush_tlb_mm(&current->mm);
+
+    // 新程序从入口地址开始执行，栈指针在 USER_END，其余寄存器清零
+    memset(regs->x, 0, sizeof(regs->x));
+    regs->sepc = entry - 4; // do_syscall 返回前会加 4
+    csr_write(sscratch, USER_END);
+    return 0;
+}
+
+// 新进程继承当前进程的优先级和打开的文件，从 path 的入口开始运行
+int64_t sys_spawn(const char *pathname)
+{
+    char path[MAX_PATH_LENGTH];
+    if (copy_path(path, pathname) != 0)
+        return -1;
+    Log("sys_spawn %s", path);
+    return do_spawn(path, current->priority, current->files);
+}
+
+/*
+ * pid 为 0 时取当前进程的缺页统计，为 -1 时取全局的统计；
+ * trace 不为 NULL 时另外拷贝最多 n 条最近的缺页记录（所有进程的），返回拷贝的条数。
+ */
+int64_t sys_faultstat(int64_t pid, struct fault_stat *stat, struct fault_record *trace, uint64_t n)
+{
+    struct fault_stat *src = &fault_stat;
+    if (pid == 0)
+        src = &current->faults;
+    else if (pid > 0)
+    {
+        if (pid >= NR_TASKS || !task[pid])
+            return -1;
+        src = &task[pid]->faults;
+    }
+    else if (pid != -1)
+        return -1;
+    if (stat)
+        memcpy(stat, src, sizeof(struct fault_stat));
+    return trace ? fault_trace_read(trace, n) : 0;
+}
+
+static uint64_t prot_to_vm(uint64_t prot)
+{
+    // RISC-V 没有只写的页表项，可写一定可读
+    return ((prot & (PROT_READ | PROT_WRITE)) ? VM_READ : 0) | ((prot & PROT_WRITE) ? VM_WRITE : 0) | ((prot & PROT_EXEC) ? VM_EXEC : 0);
+}
+
+uint64_t sys_mmap(uint64_t addr, uint64_t len, uint64_t prot, uint64_t flags, int fd, uint64_t offset)
+{
+    if (len == 0 || (offset & (PGSIZE - 1)))
+        return -EINVAL;
+    if ((flags & (MAP_SHARED | MAP_PRIVATE)) == 0 || (flags & (MAP_SHARED | MAP_PRIVATE)) == (MAP_SHARED | MAP_PRIVATE))
+        return -EINVAL;
+    // 先检查长度，否则 PGROUNDUP 可能回绕到 0
+    if (len > USER_END)
+        return -ENOMEM;
+    len = PGROUNDUP(len);
+    uint64_t vm_flags = prot_to_vm(prot) | ((flags & MAP_SHARED) ? VM_SHARED : 0);
+
+    struct file *file = NULL;
+    uint64_t filesz = 0;
+    if (flags & MAP_ANONYMOUS)
+    {
+        // 没有可以共享的后备对象：匿名页在 fork 之后首次访问、换入时都会变成各自私有的
+        if (flags & MAP_SHARED)
+            return -EINVAL;
+        vm_flags |= VM_ANON | VM_MAYWRITE;
+    }
+    else
+    {
+        if (fd < 0 || fd >= MAX_FILE_NUMBER || !current->files->fd_array[fd].opened)
+            return -EBADF;
+        file = &current->files->fd_array[fd];
+        // 只有提供 get_page 的文件系统支持 mmap
+        if (file->fs_type != FS_TYPE_FAT32 && file->fs_type != FS_TYPE_RAMFS)
+            return -ENODEV;
+        if (!(file->perms & FILE_READABLE))
+            return -EACCES;
+        if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !(file->perms & FILE_WRITABLE))
+            return -EACCES;
+        // 私有映射的写入不会回到文件
+        if (!(flags & MAP_SHARED) || (file->perms & FILE_WRITABLE))
+            vm_flags |= VM_MAYWRITE;
+        // 超出文件末尾的部分按匿名页处理（读到 0）
+        int64_t cfo = file->cfo;
+        uint64_t size = file->lseek(file, 0, SEEK_END);
+        file->cfo = cfo;
+        if (offset < size)
+            filesz = size - offset < len ? size - offset : len;
+    }
+
+    if (flags & MAP_FIXED)
+    {
+        if (addr & (PGSIZE - 1))
+            return -EINVAL;
+        int err = do_munmap(&current->mm, current->pgd, addr, len);
+        if (err)
+            return err;
+    }
+    else
+    {
+        // 2 MiB 以上的匿名映射按 2 MiB 对齐，便于使用大页
+        uint64_t align = ((vm_flags & VM_ANON) && len >= HPAGE_SIZE) ? HPAGE_SIZE : PGSIZE;
+        uint64_t hint = addr ? PGROUNDUP(addr) : MMAP_BASE;
+        if (hint < MMAP_MIN_ADDR)
+            hint = MMAP_MIN_ADDR;
+        addr = get_unmapped_area(&current->mm, hint, len + align - PGSIZE);
+        if (addr == (uint64_t)-1)
+            addr = get_unmapped_area(&current->mm, MMAP_MIN_ADDR, len + align - PGSIZE);
+        if (addr == (uint64_t)-1)
+            return -ENOMEM;
+        addr = (addr + align - 1) & ~(align - 1);
+    }
+    struct file *copy = NULL;
+    if (file && !(copy = vma_file_dup(file)))
+        return -ENOMEM;
+    if (do_mmap(&current->mm, addr, len, offset, filesz, vm_flags) != addr)
+    {
+        if (copy)
+            put_page(copy);
+        return -ENOMEM;
+    }
+    if (copy)
+        find_vma(&current->mm, addr)->vm_file = copy;
+    return addr;
+}
+
+int64_t sys_munmap(uint64_t addr, uint64_t len)
+{
+    return do_munmap(&current->mm, current->pgd, addr, len);
+}
+
+int64_t sys_mprotect(uint64_t addr, uint64_t len, uint64_t prot)
+{
+    return do_mprotect(&current->mm, current->pgd, addr, len, prot_to_vm(prot));
+}
+
+// 只有一个 hart，忽略 cpusetsize / cpus；不认识的 key 按 Linux 的约定置为 -1
+int64_t sys_riscv_hwprobe(struct riscv_hwprobe *pairs, uint64_t pair_count, uint64_t cpusetsize, uint64_t *cpus, uint64_t flags)
+{
+    if (flags != 0)
+        return -1;
+    uint64_t hwcap = boot_info.hwcap;
+    for (uint64_t i = 0; i < pair_count; i++)
+    {
+        switch (pairs[i].key)
+        {
+        case RISCV_HWPROBE_KEY_MVENDORID:
+        case RISCV_HWPROBE_KEY_MARCHID:
+        case RISCV_HWPROBE_KEY_MIMPID:
+            pairs[i].value = 0;
+            break;
+        case RISCV_HWPROBE_KEY_BASE_BEHAVIOR:
+            pairs[i].value = RISCV_HWPROBE_BASE_BEHAVIOR_IMA;
+            break;
+        case RISCV_HWPROBE_KEY_IMA_EXT_0:
+            pairs[i].value = 0;
+            if ((hwcap & HWCAP_ISA('f')) && (hwcap & HWCAP_ISA('d')))
+                pairs[i].value |= RISCV_HWPROBE_IMA_FD;
+            if (hwcap & HWCAP_ISA('c'))
+                pairs[i].value |= RISCV_HWPROBE_IMA_C;
+            if (has_vector)
+                pairs[i].value |= RISCV_HWPROBE_IMA_V;
+            break;
+        default:
+            pairs[i].key = -1;
+            pairs[i].value = 0;
+            break;
+        }
+    }
+    return 0;
+}
+
 void do_syscall(struct pt_regs *regs)
 {
     switch (regs->x[16]) // syscall a7 -> x17 -> x[16]
@@ -211,8 +472,36 @@ void do_syscall(struct pt_regs *regs)
     case SYS_GETPID:
         regs->x[9] = current->pid;
         break;
+    case SYS_EXIT:
+    case SYS_EXIT_GROUP:
+        do_exit(regs->x[9]);
+        break;
     case SYS_CLONE:
-        regs->x[9] = do_fork(regs);
+        if ((regs->x[9] & (CLONE_VFORK | CLONE_VM)) == (CLONE_VFORK | CLONE_VM))
+            regs->x[9] = do_vfork(regs);
+        else
+            regs->x[9] = do_fork(regs);
+        break;
+    case SYS_EXECVE:
+        regs->x[9] = sys_execve(regs, (const char *)regs->x[9]);
+        break;
+    case SYS_SPAWN:
+        regs->x[9] = sys_spawn((const char *)regs->x[9]);
+        break;
+    case SYS_FAULTSTAT:
+        regs->x[9] = sys_faultstat(regs->x[9], (struct fault_stat *)regs->x[10], (struct fault_record *)regs->x[11], regs->x[12]);
+        break;
+    case SYS_MMAP:
+        regs->x[9] = sys_mmap(regs->x[9], regs->x[10], regs->x[11], regs->x[12], regs->x[13], regs->x[14]);
+        break;
+    case SYS_MUNMAP:
+        regs->x[9] = sys_munmap(regs->x[9], regs->x[10]);
+        break;
+    case SYS_MPROTECT:
+        regs->x[9] = sys_mprotect(regs->x[9], regs->x[10], regs->x[11]);
+        break;
+    case SYS_RISCV_HWPROBE:
+        regs->x[9] = sys_riscv_hwprobe((struct riscv_hwprobe *)regs->x[9], regs->x[10], regs->x[11], (uint64_t *)regs->x[12], regs->x[13]);
         break;
     default:
         Err("Unimplemented system call: %d\n", regs->x[16]);
@@ -6,17 +6,214 @@
 #include "mm.h"
 #include "defs.h"
 #include "string.h"
+#include "swap.h"
+#include "fs.h"
+#include "virtio.h"
+#include "ksm.h"
 
 void clock_set_next_event();
+uint64_t get_cycles();
 
-void do_page_fault(struct pt_regs *regs, uint64_t stval, uint64_t scause)
+// 大页中的每个 4 KiB 页都只被一个映射引用
+static int huge_page_exclusive(uint64_t pte)
+{
+    uint64_t va = PTE2VA(pte);
+    for (uint64_t i = 0; i < HPAGE_NR; i++)
+    {
+        if (get_page_refcnt((void *)(va + i * PGSIZE)) > 1)
+            return 0;
+    }
+    return 1;
+}
+
+#if THP
+static int do_huge_page_fault(struct vm_area_struct *vma, uint64_t stval, uint64_t perm)
+{
+    uint64_t haddr = HPGROUNDDOWN(stval);
+    if (haddr < vma->vm_start || haddr + HPAGE_SIZE > vma->vm_end)
+        return -1;
+    // 内存碎片化导致没有连续的 2 MiB 时，回退到 4 KiB 页
+    void *page = alloc_huge_page();
+    if (!page)
+        return -1;
+    if (create_huge_mapping(current->pgd, haddr, VA2PA((uint64_t)page), perm) != 0)
+    {
+        for (uint64_t i = 0; i < HPAGE_NR; i++)
+            put_page(page + i * PGSIZE);
+        return -1;
+    }
+    memset(page, 0, HPAGE_SIZE);
+#ifdef DEBUG
+    Log("huge page %lx -> %lx", haddr, VA2PA((uint64_t)page));
+#endif
+    return 0;
+}
+#endif
+
+uint64_t fault_around_pages = FAULT_AROUND_PAGES;
+
+/*
+ * 为 vma 中的页 va 分配物理页并填充内容：
+ * 匿名空间清零；否则根据 vma->vm_pgoff 等信息从 ELF（_sramdisk）中读取，超出 vm_filesz 的部分清零。
+ */
+static void *fill_page(struct vm_area_struct *vma, uint64_t va)
+{
+    void *page = alloc_page();
+    if (!page)
+        return NULL;
+    uint64_t offset = va - vma->vm_start;
+    uint64_t len = 0;
+    if (!(vma->vm_flags & VM_ANON) && offset < vma->vm_filesz)
+    {
+        len = vma->vm_filesz - offset < PGSIZE ? vma->vm_filesz - offset : PGSIZE;
+        memcpy(page, _sramdisk + vma->vm_pgoff + offset, len);
+    }
+    memset(page + len, 0, PGSIZE - len);
+    return page;
+}
+
+/*
+ * ELF 段中完整落在文件内、且在 ramdisk 里页对齐的页，直接返回 ramdisk 中的那一页。
+ * ramdisk 属于内核镜像，在 buddy_init 中已经占有一个永远不会释放的引用，
+ * 所以这里加上的引用在 munmap / 进程退出时减掉之后页也不会回到 buddy。
+ */
+static void *elf_shared_page(struct vm_area_struct *vma, uint64_t offset)
+{
+    if (offset + PGSIZE > vma->vm_filesz)
+        return NULL;
+    char *src = _sramdisk + vma->vm_pgoff + offset;
+    if ((uint64_t)src % PGSIZE)
+        return NULL;
+    get_page(src);
+    return src;
+}
+
+/*
+ * 取得要映射到 va 的物理页（已经持有一个引用），perm 可能被去掉 PTE_W。
+ * mmap 的文件页来自页缓存：共享映射直接映射缓存页；私有映射在读时只读映射缓存页，
+ * 写入时由写时复制得到私有的页，写缺页则直接复制一份。文件末尾之后的页按匿名页处理。
+ * ELF 段同理：只读段的页所有进程共享 ramdisk 中的同一页，可写段在读时也先只读共享，
+ * 只有写入时和文件末尾与 bss 交界的那一页才分配私有的页。
+ * 私有映射中全零的页在读时映射零页。
+ * around 为 1 时（fault-around）不读盘，文件页不在页缓存中时返回 NULL。
+ */
+static void *get_fault_page(struct vm_area_struct *vma, uint64_t va, uint64_t *perm, int write, int around)
+{
+    uint64_t offset = va - vma->vm_start;
+    // 读取全零的页（匿名空间、bss）时只读映射零页，写入时走写时复制
+    if (!write && !(vma->vm_flags & VM_SHARED) && ((vma->vm_flags & VM_ANON) || offset >= vma->vm_filesz))
+    {
+        get_page(zero_page);
+        *perm &= ~PTE_W;
+        return zero_page;
+    }
+    if (!(vma->vm_flags & VM_ANON) && !vma->vm_file && !write)
+    {
+        void *page = elf_shared_page(vma, offset);
+        if (page)
+        {
+            *perm &= ~PTE_W;
+            return page;
+        }
+    }
+    if (!vma->vm_file || offset >= vma->vm_filesz)
+        return fill_page(vma, va);
+    uint64_t index = (vma->vm_pgoff + offset) / PGSIZE;
+    void *page = around ? vma->vm_file->find_page(vma->vm_file, index) : vma->vm_file->get_page(vma->vm_file, index);
+    if (!page || (vma->vm_flags & VM_SHARED))
+        return page;
+    uint64_t len = vma->vm_filesz - offset;
+    if (!write && len >= PGSIZE)
+    {
+        *perm &= ~PTE_W;
+        return page;
+    }
+    // 文件内容在这一页中间结束（例如 ELF 段的 p_filesz 之后是 bss）时，后面的部分在私有的页中清零
+    if (len > PGSIZE)
+        len = PGSIZE;
+    void *copy = alloc_page();
+    if (copy)
+    {
+        memcpy(copy, page, len);
+        memset(copy + len, 0, PGSIZE - len);
+    }
+    put_page(page);
+    return copy;
+}
+
+// 把 [start, end) 中还没有页表项的页一并映射上；已映射、已换出的页保持不变
+static void map_pages(struct vm_area_struct *vma, uint64_t start, uint64_t end, uint64_t perm, int write)
+{
+    for (uint64_t va = start; va < end; va += PGSIZE)
+    {
+        uint64_t *pte_p = find_pte(current->pgd, va);
+        if (pte_p && *pte_p)
+            continue;
+        uint64_t page_perm = perm;
+        void *page = get_fault_page(vma, va, &page_perm, write, 1);
+        if (!page && vma->vm_file)
+            continue; // 不在页缓存中
+        if (!page)
+            return;
+        create_mapping(current->pgd, va, VA2PA((uint64_t)page), PGSIZE, page_perm);
+        current->faults.around++;
+        fault_stat.around++;
+    }
+}
+
+/*
+ * fault-around：
+ * 映射 va 所在的、按 fault_around_pages 对齐的窗口中已经在内存里的页：ELF 中的内容（多数页直接共享 ramdisk），
+ * 以及文件已经在页缓存中的页，不在缓存中的页留给之后的缺页读盘；
+ * 匿名空间只有在缺页地址紧接着上一次缺页（顺序访问）时才预先分配后面的页。
+ * 窗口不超出 VMA 和 va 所在的 2 MiB 区域（同一张末级页表）。
+ */
+static void do_fault_around(struct vm_area_struct *vma, uint64_t va, uint64_t perm, int write)
+{
+    uint64_t nr = fault_around_pages;
+    struct mm_struct *mm = &current->mm;
+    int sequential = va == mm->last_fault_va + PGSIZE;
+    mm->last_fault_va = va;
+    if (nr <= 1)
+        return;
+    uint64_t start, end;
+    if (!(vma->vm_flags & VM_ANON))
+    {
+        start = va - (va / PGSIZE % nr) * PGSIZE;
+        end = start + nr * PGSIZE;
+    }
+    else if (sequential)
+    {
+        start = va + PGSIZE;
+        end = va + nr * PGSIZE;
+    }
+    else
+        return;
+    if (start < vma->vm_start)
+        start = vma->vm_start;
+    if (start < HPGROUNDDOWN(va))
+        start = HPGROUNDDOWN(va);
+    if (end > vma->vm_end)
+        end = vma->vm_end;
+    if (end > HPGROUNDDOWN(va) + HPAGE_SIZE)
+        end = HPGROUNDDOWN(va) + HPAGE_SIZE;
+    // 匿名空间按这次缺页是读还是写决定预先映射零页还是分配新页
+    write = write && (vma->vm_flags & VM_ANON);
+    map_pages(vma, start, va, perm, write);
+    map_pages(vma, va + PGSIZE, end, perm, write);
+    if (vma->vm_flags & VM_ANON)
+        mm->last_fault_va = end - PGSIZE; // 下一次顺序缺页从预分配的页之后开始
+}
+
+// 处理缺页，返回缺页的分类 FAULT_*
+static int handle_page_fault(struct pt_regs *regs, uint64_t stval, uint64_t scause)
 {
 #ifdef DEBUG
     Log("pc: %lx, stval: %lx", regs->sepc, stval);
 #endif
     // 通过 stval 获得访问出错的虚拟内存地址（Bad Address）
-    // 通过 find_vma() 查找 bad address 是否在某个 vma 中
-    struct vm_area_struct *vma = find_vma(&current->mm, stval);
+    // 通过 find_vma() 查找 bad address 是否在某个 vma 中，在栈下方时扩展栈
+    struct vm_area_struct *vma = find_extend_vma(&current->mm, stval);
     // 如果不在，则出现非预期错误，可以通过 Err 宏输出错误信息
     if (!vma)
     {
@@ -27,6 +224,11 @@ void do_page_fault(struct pt_regs *regs, uint64_t stval, uint64_t scause)
         }
         Err("VMA not found");
     }
+    // 缺页处理（包括 fault-around）只修改 stval 所在 2 MiB 区域的页表项，先取得私有的末级页表
+    if (unshare_pte_table(&current->mm, current->pgd, stval) != 0)
+    {
+        Err("out of memory");
+    }
     // 如果在，则根据 vma 的 flags 权限判断当前 page fault 是否合法
     // 如果非法（比如触发的是 instruction page fault 但 vma 权限不允许执行），则 Err 输出错误信息
     switch (scause)
@@ -51,9 +253,28 @@ void do_page_fault(struct pt_regs *regs, uint64_t stval, uint64_t scause)
         else
         {
             // 如果发生了写错误，且 vma 的 VM_WRITE 位为 1，而且对应地址有 pte（进行了映射）但 pte 的 PTE_W 位为 0，那么就可以断定这是一个写时复制的页面，我们只需要在这个时候拷贝一份原来的页面，重新创建一个映射即可。
+            uint64_t *huge_pte_p = find_huge_pte(current->pgd, stval);
+            if (huge_pte_p)
+            {
+                // 大页只被当前进程引用时直接恢复写权限，否则拆成 4 KiB 页表项，只复制被写的那一页
+                if ((vma->vm_flags & VM_SHARED) || huge_page_exclusive(*huge_pte_p))
+                {
+#ifdef DEBUG
+                    Log("huge page direct write");
+#endif
+                    *huge_pte_p |= PTE_W;
+                    flush_tlb_page(&current->mm, stval);
+                    return FAULT_COW_REUSE;
+                }
+                if (split_huge_mapping(current->pgd, stval) != 0)
+                {
+                    Err("out of memory");
+                }
+                flush_tlb_mm(&current->mm); // 大页项换成了指向末级页表的非叶子项
+            }
             uint64_t *pte_p = find_pte(current->pgd, stval);
             uint64_t pte = pte_p ? *pte_p : 0;
-            if (!pte) // no PTE, not COW
+            if (!pte || IS_SWAP_PTE(pte)) // no PTE or swapped out, not COW
                 break;
 
             if ((pte & PTE_W) != 0) // PTE_W is not 0, not COW
@@ -64,18 +285,27 @@ void do_page_fault(struct pt_regs *regs, uint64_t stval, uint64_t scause)
 #endif
             // 拷贝了页面之后，别忘了将原来的页面引用计数减一。这样父子进程想要写入的时候，都会触发 COW，并拷贝一个新页面，都拷贝完成后，原来的页面将自动 free 掉。
             // 进一步的，父进程 COW 后，子进程再进行写入的时候，也可以在这时判断引用计数，如果计数为 1，说明这个页面只有一个引用，那么就可以直接将 pte 的 PTE_W 位再置 1，这样就可以直接写入了，免去一次额外的复制。
-            if (get_page_refcnt((void *)PTE2VA(pte)) > 1) // cow
+            // MAP_SHARED 的页被所有映射共享，不复制
+            if (!(vma->vm_flags & VM_SHARED) && get_page_refcnt((void *)PTE2VA(pte)) > 1) // cow
             {
 #ifdef DEBUG
                 Log("page copy");
 #endif
                 void *old_page = (void *)PTE2VA(pte);
                 uint64_t old_flags = pte & PTE_FLAGS_MASK;
+                if (page_ksm(old_page))
+                    ksm_stat.unmerged++;
                 void *new_page = alloc_page();
+                if (!new_page)
+                {
+                    Err("out of memory");
+                }
                 uint64_t new_flags = old_flags | PTE_W;
                 memcpy(new_page, old_page, PGSIZE);
                 create_mapping(current->pgd, PGROUNDDOWN(stval), VA2PA((uint64_t)new_page), PGSIZE, new_flags);
+                flush_tlb_page(&current->mm, stval);
                 put_page(old_page);
+                return FAULT_COW_COPY;
             }
             else // direct write
             {
@@ -83,8 +313,9 @@ void do_page_fault(struct pt_regs *regs, uint64_t stval, uint64_t scause)
                 Log("direct write");
 #endif
                 *pte_p = pte | PTE_W;
+                flush_tlb_page(&current->mm, stval);
+                return FAULT_COW_REUSE;
             }
-            return;
         }
         break;
     default:
@@ -95,31 +326,88 @@ void do_page_fault(struct pt_regs *regs, uint64_t stval, uint64_t scause)
     Log("vma flags: VM_READ %d VM_WRITE %d VM_EXEC %d VM_ANON %d", vma->vm_flags & VM_READ, vma->vm_flags & VM_WRITE, vma->vm_flags & VM_EXEC, vma->vm_flags & VM_ANON);
 #endif
     // 其他情况合法，需要我们按接下来的流程创建映射
-    // 分配一个页，接下来要将这个页映射到对应的用户地址空间
-    void *page = alloc_page();
     // 通过 (vma->vm_flags & VM_ANONYM) 获得当前的 VMA 是否是匿名空间
     uint64_t perm = ((vma->vm_flags & VM_WRITE) ? PTE_W : 0) | ((vma->vm_flags & VM_EXEC) ? PTE_X : 0) | ((vma->vm_flags & VM_READ) ? PTE_R : 0) | PTE_V | PTE_U;
-    // 如果是匿名空间，则直接映射即可
-    create_mapping(current->pgd, PGROUNDDOWN(stval), VA2PA((uint64_t)page), PGSIZE, perm);
-    // 如果不是，则需要根据 vma->vm_pgoff 等信息从 ELF 中读取数据，填充后映射到用户空间
-    if (!(vma->vm_flags & VM_ANON))
+    // 页面已被换出，从 swap 分区读回
+    uint64_t *swap_pte_p = find_pte(current->pgd, stval);
+    if (swap_pte_p && IS_SWAP_PTE(*swap_pte_p))
     {
-        uint64_t target_offset = stval - vma->vm_start;
-        uint64_t page_down_offset = PGROUNDDOWN(stval) - vma->vm_start;
-        uint64_t page_up_offset = PGROUNDUP(stval) - vma->vm_start;
-        if (page_down_offset >= vma->vm_filesz)
-            memset(page, 0, PGSIZE);
-        else if (page_up_offset <= vma->vm_filesz)
-            memcpy(page, _sramdisk + vma->vm_pgoff + page_down_offset, PGSIZE);
-        else
+        if (swap_in(swap_pte_p, perm) != 0)
         {
-            uint64_t zero_size = page_up_offset - vma->vm_filesz;
-            memcpy(page, _sramdisk + vma->vm_pgoff + page_down_offset, PGSIZE - (zero_size));
-            memset(page + vma->vm_filesz - page_down_offset, 0, zero_size);
+            Err("out of memory");
         }
+        return FAULT_SWAP;
+    }
+#if THP
+    // 匿名空间中完整包含在 VMA 内的 2 MiB 对齐区域，写缺页时优先用一个大页映射（读缺页映射零页）
+    if ((vma->vm_flags & VM_ANON) && scause == 0x000000000000000F && do_huge_page_fault(vma, stval, perm) == 0)
+    {
+        current->faults.huge++;
+        fault_stat.huge++;
+        return FAULT_ZERO;
+    }
+#endif
+    // 分配一个页，接下来要将这个页映射到对应的用户地址空间
+    uint64_t va = PGROUNDDOWN(stval);
+    uint64_t page_perm = perm;
+    int write = scause == 0x000000000000000F;
+    void *page = get_fault_page(vma, va, &page_perm, write, 0);
+    if (!page)
+    {
+        Err("out of memory");
+    }
+    create_mapping(current->pgd, va, VA2PA((uint64_t)page), PGSIZE, page_perm);
+    do_fault_around(vma, va, perm, write);
+    return ((vma->vm_flags & VM_ANON) || va - vma->vm_start >= vma->vm_filesz) ? FAULT_ZERO : FAULT_FILE;
+}
+
+struct fault_stat fault_stat;
+uint64_t fault_trace;
+static struct fault_record fault_records[FAULT_TRACE_SIZE];
+static uint64_t nr_fault_records; // 写入过的记录总数，下一条写在 nr_fault_records % FAULT_TRACE_SIZE
+
+static void account_fault(struct fault_stat *stat, int type, int major, uint64_t cycles)
+{
+    if (major)
+        stat->major++;
+    else
+        stat->minor++;
+    stat->count[type]++;
+    stat->cycles[type] += cycles;
+}
+
+void do_page_fault(struct pt_regs *regs, uint64_t stval, uint64_t scause)
+{
+    uint64_t start = get_cycles();
+    uint64_t read_sectors = virtio_blk_stat.read_sectors;
+    int type = handle_page_fault(regs, stval, scause);
+    uint64_t cycles = get_cycles() - start;
+    // 处理过程中读过磁盘：换入，或者文件页不在页缓存中
+    int major = type == FAULT_SWAP || virtio_blk_stat.read_sectors != read_sectors;
+    account_fault(&current->faults, type, major, cycles);
+    account_fault(&fault_stat, type, major, cycles);
+    if (fault_trace)
+    {
+        struct fault_record *r = &fault_records[nr_fault_records++ % FAULT_TRACE_SIZE];
+        r->pid = current->pid;
+        r->pc = regs->sepc;
+        r->va = stval;
+        r->type = type;
+        r->major = major;
+        r->cycles = cycles;
     }
 }
 
+uint64_t fault_trace_read(struct fault_record *buf, uint64_t n)
+{
+    uint64_t nr = nr_fault_records < FAULT_TRACE_SIZE ? nr_fault_records : FAULT_TRACE_SIZE;
+    if (n > nr)
+        n = nr;
+    for (uint64_t i = 0; i < n; i++)
+        memcpy(&buf[i], &fault_records[(nr_fault_records - n + i) % FAULT_TRACE_SIZE], sizeof(struct fault_record));
+    return n;
+}
+
 void trap_handler(uint64_t scause, uint64_t sepc, struct pt_regs *regs, uint64_t stval)
 {
     // 通过 `scause` 判断 trap 类型
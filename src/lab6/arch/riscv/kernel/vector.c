@@ -0,0 +1,151 @@
+#include "vector.h"
+#include "defs.h"
+#include "fdt.h"
+#include "string.h"
+#include "printk.h"
+#include "proc.h"
+#include "mm.h"
+
+int has_vector;
+static int vregs_live; // 向量寄存器中是否还留着某个进程的数据
+
+// 设备树表明支持 V 扩展时，打开 sstatus.VS，并让 memcpy / memset 使用 RVV 实现
+void vector_init(void)
+{
+    if (!(boot_info.hwcap & HWCAP_ISA('v')))
+    {
+        printk("...vector_init: V extension not present\n");
+        return;
+    }
+    has_vector = 1;
+    csr_write(sstatus, (csr_read(sstatus) & ~SSTATUS_VS) | SSTATUS_VS_INITIAL);
+    string_rvv_enabled = 1;
+    printk("...vector_init done! vlenb = %d\n", csr_read(0xc22)); // 0xc22: vlenb
+}
+
+// vstate 布局：vl, vtype, vstart, vcsr，之后是 v0-v31（共 32 * vlenb 字节）
+#define VSTATE_CSRS 4
+
+static void *vstate_alloc(void)
+{
+    uint64_t size = VSTATE_CSRS * sizeof(uint64_t) + 32 * csr_read(0xc22);
+    void *state = alloc_pages(PGROUNDUP(size) / PGSIZE);
+    if (!state)
+    {
+        Err("out of memory");
+    }
+    return state;
+}
+
+static void vstate_save(uint64_t *state)
+{
+    uint64_t step = 8 * csr_read(0xc22); // vs8r.v 一次保存 8 个寄存器
+    uint8_t *v = (uint8_t *)(state + VSTATE_CSRS);
+    state[0] = csr_read(0xc20); // vl
+    state[1] = csr_read(0xc21); // vtype
+    state[2] = csr_read(0x008); // vstart
+    state[3] = csr_read(0x00f); // vcsr
+    asm volatile(".option push\n"
+                 ".option arch, +v\n"
+                 "vs8r.v v0, (%0)\n"
+                 "add %0, %0, %1\n"
+                 "vs8r.v v8, (%0)\n"
+                 "add %0, %0, %1\n"
+                 "vs8r.v v16, (%0)\n"
+                 "add %0, %0, %1\n"
+                 "vs8r.v v24, (%0)\n"
+                 ".option pop"
+                 : "+r"(v)
+                 : "r"(step)
+                 : "memory");
+}
+
+static void vstate_restore(uint64_t *state)
+{
+    uint64_t step = 8 * csr_read(0xc22);
+    uint8_t *v = (uint8_t *)(state + VSTATE_CSRS);
+    // 整寄存器加载不依赖 vtype，最后再用 vsetvl 恢复 vl / vtype
+    asm volatile(".option push\n"
+                 ".option arch, +v\n"
+                 "vl8r.v v0, (%0)\n"
+                 "add %0, %0, %1\n"
+                 "vl8r.v v8, (%0)\n"
+                 "add %0, %0, %1\n"
+                 "vl8r.v v16, (%0)\n"
+                 "add %0, %0, %1\n"
+                 "vl8r.v v24, (%0)\n"
+                 "vsetvl zero, %2, %3\n"
+                 ".option pop"
+                 : "+r"(v)
+                 : "r"(step), "r"(state[0]), "r"(state[1])
+                 : "memory");
+    csr_write(0x008, state[2]);
+    csr_write(0x00f, state[3]);
+}
+
+// 换入没有向量状态的进程前清空寄存器，避免它读到上一个进程的数据
+static void vstate_clear(void)
+{
+    asm volatile(".option push\n"
+                 ".option arch, +v\n"
+                 "vsetvli t0, zero, e8, m8, ta, ma\n"
+                 "vmv.v.i v0, 0\n"
+                 "vmv.v.i v8, 0\n"
+                 "vmv.v.i v16, 0\n"
+                 "vmv.v.i v24, 0\n"
+                 ".option pop"
+                 :
+                 :
+                 : "t0", "memory");
+    csr_write(0x008, 0);
+    csr_write(0x00f, 0);
+}
+
+// 只有 sstatus.VS 为 Dirty（换入之后写过向量寄存器）时才保存，保存后标记为 Clean
+void vector_switch(struct task_struct *prev, struct task_struct *next)
+{
+    if (!has_vector)
+        return;
+    if ((csr_read(sstatus) & SSTATUS_VS) == SSTATUS_VS_DIRTY)
+    {
+        if (!prev->vstate)
+            prev->vstate = vstate_alloc();
+        vstate_save(prev->vstate);
+        csr_write(sstatus, (csr_read(sstatus) & ~SSTATUS_VS) | SSTATUS_VS_CLEAN);
+        vregs_live = 1;
+    }
+    if (!next->vstate && !vregs_live)
+        return;
+    // 恢复、清空都会把 VS 置为 Dirty，而此时的 sstatus 还要被 __switch_to 保存为 prev 的，需要改回去
+    uint64_t sstatus = csr_read(sstatus);
+    if (next->vstate)
+        vstate_restore(next->vstate);
+    else
+        vstate_clear();
+    vregs_live = next->vstate != NULL;
+    csr_write(sstatus, sstatus);
+}
+
+void vector_fork(struct task_struct *child)
+{
+    child->vstate = NULL;
+    if (!has_vector)
+        return;
+    if ((csr_read(sstatus) & SSTATUS_VS) == SSTATUS_VS_DIRTY || current->vstate)
+    {
+        // 当前的向量寄存器就是父进程的状态，直接保存给子进程
+        uint64_t sstatus = csr_read(sstatus);
+        child->vstate = vstate_alloc();
+        vstate_save(child->vstate);
+        csr_write(sstatus, sstatus);
+    }
+}
+
+void vector_exit(struct task_struct *task)
+{
+    if (task->vstate)
+    {
+        put_page(task->vstate);
+        task->vstate = NULL;
+    }
+}
@@ -4,6 +4,11 @@
 #include "vm.h"
 #include "printk.h"
 #include "virtio.h"
+#include "proc.h"
+#include "fdt.h"
+#include "fs.h"
+#include "swap.h"
+#include "errno.h"
 
 void print_pgtbl(uint64_t *pgtbl)
 {
@@ -23,6 +28,8 @@ void print_pgtbl(uint64_t *pgtbl)
                 {
                     printk(" ....");
                     printk(" %lx: pte %016lx pa %016lx\n", &pgtbl1[j], ((uint64_t *)pgtbl1)[j], PTE2PA(((uint64_t *)pgtbl1)[j]));
+                    if (PTE_IS_LEAF(pgtbl1[j]))
+                        continue;
                     pgtbl2 = (uint64_t *)PTE2VA(((uint64_t *)pgtbl1)[j]);
                     for (int k = 0; k < 512; k++)
                     {
@@ -38,10 +45,12 @@ void print_pgtbl(uint64_t *pgtbl)
     }
 }
 
+uint64_t nr_vmas; // 已分配的 vm_area_struct 数量（每个占用一页）
+
 /* early_pgtbl: 用于 setup_vm 进行 1GiB 的映射 */
 uint64_t early_pgtbl[512] __attribute__((__aligned__(0x1000)));
 
-void setup_vm(void)
+void setup_vm(uint64_t dtb_pa)
 {
     /*
      * 1. 由于是进行 1GiB 的映射，这里不需要使用多级页表
@@ -54,6 +63,10 @@ void setup_vm(void)
     memset(early_pgtbl, 0x0, PGSIZE);
     early_pgtbl[VA2VPN2(VM_START)] = PPN2(PA2PPN2(PHY_START)) | PTE_V | PTE_R | PTE_W | PTE_X;
     early_pgtbl[VA2VPN2(PHY_START)] = PPN2(PA2PPN2(PHY_START)) | PTE_V | PTE_R | PTE_W | PTE_X;
+    // 设备树可能位于第一个 1GiB 之外（内存较大时 QEMU 将其放在内存末尾），为它所在的 1GiB 额外建立线性映射，供 fdt_init 读取
+    fdt_pa = dtb_pa;
+    if (dtb_pa >= PHY_START && PA2PPN2(dtb_pa) != PA2PPN2(PHY_START))
+        early_pgtbl[VA2VPN2(PA2VA(dtb_pa))] = PPN2(PA2PPN2(dtb_pa)) | PTE_V | PTE_R | PTE_W;
     printk("...setup_vm done\n");
 }
 
@@ -75,16 +88,28 @@ void setup_vm_final(void)
     create_mapping(swapper_pg_dir, (uint64_t)_srodata, (uint64_t)_srodata - PA2VA_OFFSET, (uint64_t)_erodata - (uint64_t)_srodata, PTE_R | PTE_V);
 
     // mapping other memory -|W|R|V
-    create_mapping(swapper_pg_dir, (uint64_t)_sdata, (uint64_t)_sdata - PA2VA_OFFSET, (uint64_t)(VM_START + PHY_SIZE) - (uint64_t)_sdata, PTE_R | PTE_W | PTE_V);
+    // 物理内存可能由多个区间组成，逐个映射；内核所在区间从 _sdata 开始
+    for (uint64_t i = 0; i < boot_info.nr_mem; i++)
+    {
+        uint64_t start = boot_info.mem[i].base;
+        uint64_t end = boot_info.mem[i].base + boot_info.mem[i].size;
+        if (start < VA2PA((uint64_t)_sdata))
+            start = VA2PA((uint64_t)_sdata);
+        if (end > start)
+            create_mapping(swapper_pg_dir, PA2VA(start), start, end - start, PTE_R | PTE_W | PTE_V);
+    }
 
     // set satp with swapper_pg_dir
     csr_write(satp, (SATP_PPN(VA2PA((uint64_t)swapper_pg_dir)) | SATP_SV39));
 
     // lab6: virtio
-    create_mapping(swapper_pg_dir, io_to_virt(VIRTIO_START), VIRTIO_START, VIRTIO_SIZE * VIRTIO_COUNT, PTE_W | PTE_R | PTE_V);
+    for (uint64_t i = 0; i < boot_info.nr_virtio; i++)
+    {
+        create_kernel_mapping(io_to_virt(boot_info.virtio[i].base), boot_info.virtio[i].base, boot_info.virtio[i].size, PTE_W | PTE_R | PTE_V);
+    }
 
     // flush TLB
-    asm volatile("sfence.vma zero, zero");
+    flush_tlb_all();
 
     // flush icache
     asm volatile("fence.i");
@@ -118,14 +143,27 @@ void create_mapping(uint64_t *pgtbl, uint64_t va, uint64_t pa, uint64_t sz, uint
     {
         if (!PTE_IS_VALID(pgtbl[vpn2]))
         {
-            pgtbl[vpn2] = VA2PTE((uint64_t)kalloc()) | PTE_V;
+            // kalloc 返回的页可能是回收的旧页，新页表必须清零
+            uint64_t *new_pgtbl1 = (uint64_t *)kalloc();
+            memset(new_pgtbl1, 0x0, PGSIZE);
+            pgtbl[vpn2] = VA2PTE((uint64_t)new_pgtbl1) | PTE_V;
         }
         uint64_t *pgtbl1 = (uint64_t *)PTE2VA(pgtbl[vpn2]);
         for (; vpn2 == VA2VPN2(va + sz - 1) ? vpn1 <= VA2VPN1(va + sz - 1) : vpn1 < 512; vpn1++)
         {
             if (!PTE_IS_VALID(pgtbl1[vpn1]))
             {
-                pgtbl1[vpn1] = VA2PTE((uint64_t)kalloc()) | PTE_V;
+                uint64_t *new_pgtbl0 = (uint64_t *)kalloc();
+                memset(new_pgtbl0, 0x0, PGSIZE);
+                pgtbl1[vpn1] = VA2PTE((uint64_t)new_pgtbl0) | PTE_V;
+            }
+            if (PTE_IS_LEAF(pgtbl1[vpn1]))
+            {
+                // 在 2 MiB 大页内部建立 4 KiB 映射，先把大页拆成页表
+                if (split_huge_mapping(pgtbl, VPN2(vpn2) | VPN1(vpn1)) != 0)
+                {
+                    Err("out of memory");
+                }
             }
             uint64_t *pgtbl0 = (uint64_t *)PTE2VA(pgtbl1[vpn1]);
             for (; vpn1 == VA2VPN1(va + sz - 1) ? vpn0 <= VA2VPN0(va + sz - 1) : vpn0 < 512; vpn0++)
@@ -145,41 +183,43 @@ void create_mapping(uint64_t *pgtbl, uint64_t va, uint64_t pa, uint64_t sz, uint
     }
 }
 
+/*
+ * 为新进程创建根页表：只复制根页表页本身，内核空间的二级、三级页表按引用共享，
+ * 所有进程看到的都是 swapper_pg_dir 下的同一棵子树。
+ * 用户空间（VA2VPN2(USER_END) 以下）不会出现在 swapper_pg_dir 中，因此新根页表的用户部分为空。
+ */
 uint64_t *sv39_pg_dir_dup(uint64_t *pgtbl)
 {
 #ifdef DEBUG
     Log("");
 #endif
     uint64_t *new_pgtbl = (uint64_t *)alloc_page();
+    if (!new_pgtbl)
+        return NULL;
     memset(new_pgtbl, 0x0, PGSIZE);
-    for (uint64_t vpn2 = 0; vpn2 < 512; vpn2++)
+    for (uint64_t vpn2 = VA2VPN2(USER_END); vpn2 < 512; vpn2++)
     {
-        if (PTE_IS_VALID(pgtbl[vpn2]))
+        new_pgtbl[vpn2] = pgtbl[vpn2];
+    }
+    return new_pgtbl;
+}
+
+/*
+ * 在内核页表中建立映射。子树是共享的，所以已有根页表项下的新映射对所有进程立即可见；
+ * 只有新增的根页表项需要同步到每个进程的根页表中。
+ */
+void create_kernel_mapping(uint64_t va, uint64_t pa, uint64_t sz, uint64_t perm)
+{
+    create_mapping(swapper_pg_dir, va, pa, sz, perm);
+    for (int i = 0; i < NR_TASKS; i++)
+    {
+        if (!task[i] || !task[i]->pgd)
+            continue;
+        for (uint64_t vpn2 = VA2VPN2(va); vpn2 <= VA2VPN2(va + sz - 1); vpn2++)
         {
-            uint64_t *new_pgtbl1 = alloc_page();
-            memset(new_pgtbl1, 0x0, PGSIZE);
-            new_pgtbl[vpn2] = VA2PTE((uint64_t)new_pgtbl1) | PTE_V;
-            uint64_t *pgtbl1 = (uint64_t *)PTE2VA(pgtbl[vpn2]);
-            for (uint64_t vpn1 = 0; vpn1 < 512; vpn1++)
-            {
-                if (PTE_IS_VALID(pgtbl1[vpn1]))
-                {
-                    uint64_t *new_pgtbl0 = alloc_page();
-                    memset(new_pgtbl0, 0x0, PGSIZE);
-                    new_pgtbl1[vpn1] = VA2PTE((uint64_t)new_pgtbl0) | PTE_V;
-                    uint64_t *pgtbl0 = (uint64_t *)PTE2VA(pgtbl1[vpn1]);
-                    for (uint64_t vpn0 = 0; vpn0 < 512; vpn0++)
-                    {
-                        if (PTE_IS_VALID(pgtbl0[vpn0]))
-                        {
-                            new_pgtbl0[vpn0] = pgtbl0[vpn0];
-                        }
-                    }
-                }
-            }
+            task[i]->pgd[vpn2] = swapper_pg_dir[vpn2];
         }
     }
-    return new_pgtbl;
 }
 
 uint64_t *find_pte(uint64_t *pgtbl, uint64_t va)
@@ -195,26 +235,214 @@ uint64_t *find_pte(uint64_t *pgtbl, uint64_t va)
     uint64_t vpn1 = VA2VPN1(va);
     if (!PTE_IS_VALID(pgtbl1[vpn1]))
         return NULL;
+    if (PTE_IS_LEAF(pgtbl1[vpn1])) // 2 MiB 大页，返回二级页表中的叶子项
+        return &pgtbl1[vpn1];
     uint64_t *pgtbl2 = (uint64_t *)PTE2VA(pgtbl1[vpn1]);
     if (!pgtbl2)
         return NULL;
     return &pgtbl2[VA2VPN0(va)];
 }
 
+uint64_t *find_huge_pte(uint64_t *pgtbl, uint64_t va)
+{
+    if (!pgtbl || !PTE_IS_VALID(pgtbl[VA2VPN2(va)]))
+        return NULL;
+    uint64_t *pgtbl1 = (uint64_t *)PTE2VA(pgtbl[VA2VPN2(va)]);
+    uint64_t *pte_p = &pgtbl1[VA2VPN1(va)];
+    if (!PTE_IS_VALID(*pte_p) || !PTE_IS_LEAF(*pte_p))
+        return NULL;
+    return pte_p;
+}
+
+int create_huge_mapping(uint64_t *pgtbl, uint64_t va, uint64_t pa, uint64_t perm)
+{
+#ifdef DEBUG
+    Log("va %lx pa %lx perm %lx", va, pa, perm);
+#endif
+    uint64_t vpn2 = VA2VPN2(va);
+    if (!PTE_IS_VALID(pgtbl[vpn2]))
+    {
+        uint64_t *new_pgtbl1 = (uint64_t *)kalloc();
+        memset(new_pgtbl1, 0x0, PGSIZE);
+        pgtbl[vpn2] = VA2PTE((uint64_t)new_pgtbl1) | PTE_V;
+    }
+    uint64_t *pgtbl1 = (uint64_t *)PTE2VA(pgtbl[vpn2]);
+    // 该 2 MiB 区域中已经有 4 KiB 映射（或页表），不能用大页覆盖
+    if (PTE_IS_VALID(pgtbl1[VA2VPN1(va)]))
+        return -1;
+    pgtbl1[VA2VPN1(va)] = PA2PTE(HPGROUNDDOWN(pa)) | perm;
+    return 0;
+}
+
+int split_huge_mapping(uint64_t *pgtbl, uint64_t va)
+{
+    uint64_t *pte_p = find_huge_pte(pgtbl, va);
+    if (!pte_p)
+        return 0;
+#ifdef DEBUG
+    Log("split huge pte %lx at va %lx", *pte_p, va);
+#endif
+    // 大页在分配时已经按单页拆分（见 alloc_huge_page），这里只需要展开页表项，引用计数不变
+    uint64_t pa = PTE2PA(*pte_p);
+    uint64_t flags = *pte_p & PTE_FLAGS_MASK;
+    uint64_t *pgtbl0 = (uint64_t *)kalloc();
+    if (!pgtbl0)
+        return -1;
+    for (uint64_t vpn0 = 0; vpn0 < 512; vpn0++)
+    {
+        pgtbl0[vpn0] = PA2PTE(pa + vpn0 * PGSIZE) | flags;
+    }
+    *pte_p = VA2PTE((uint64_t)pgtbl0) | PTE_V;
+    return 0;
+}
+
+// 统计 mm 中已经映射了物理页的用户页数量
+uint64_t mm_rss(uint64_t *pgtbl, struct mm_struct *mm)
+{
+    uint64_t rss = 0;
+    for (struct vm_area_struct *vma = mm->mmap; vma; vma = vma->vm_next)
+    {
+        for (uint64_t va = vma->vm_start; va < vma->vm_end; va += PGSIZE)
+        {
+            uint64_t *pte_p = find_pte(pgtbl, va);
+            if (pte_p && PTE_IS_VALID(*pte_p))
+                rss++;
+        }
+    }
+    return rss;
+}
+
+void mm_struct_init(struct mm_struct *mm, uint64_t asid)
+{
+    mm->mmap = NULL;
+    mm->mm_rb = RB_ROOT;
+    for (int i = 0; i < VMACACHE_SIZE; i++)
+        mm->vmacache[i] = NULL;
+    mm->last_fault_va = 0;
+    mm->asid = asid;
+}
+
+// vm_max_gap = max(自身的 vm_gap, 左右子树的 vm_max_gap)
+static void vma_augment(struct rb_node *node)
+{
+    struct vm_area_struct *vma = rb_entry(node, struct vm_area_struct, vm_rb);
+    uint64_t max_gap = vma->vm_gap;
+    if (node->rb_left && rb_entry(node->rb_left, struct vm_area_struct, vm_rb)->vm_max_gap > max_gap)
+        max_gap = rb_entry(node->rb_left, struct vm_area_struct, vm_rb)->vm_max_gap;
+    if (node->rb_right && rb_entry(node->rb_right, struct vm_area_struct, vm_rb)->vm_max_gap > max_gap)
+        max_gap = rb_entry(node->rb_right, struct vm_area_struct, vm_rb)->vm_max_gap;
+    vma->vm_max_gap = max_gap;
+}
+
+uint64_t stack_limit_pages = STACK_LIMIT_PAGES;
+
+// vma 前面可以分配给新映射的空洞大小；栈要为增长到上限和保护间隔留出空间
+static uint64_t vma_free_gap(struct vm_area_struct *vma, uint64_t prev_end)
+{
+    uint64_t gap = vma->vm_start - prev_end;
+    if (vma->vm_flags & VM_GROWSDOWN)
+    {
+        uint64_t size = vma->vm_end - vma->vm_start;
+        uint64_t reserve = STACK_GUARD_GAP + (stack_limit_pages * PGSIZE > size ? stack_limit_pages * PGSIZE - size : 0);
+        gap = gap > reserve ? gap - reserve : 0;
+    }
+    return gap;
+}
+
+// 前一个 VMA 变化之后重新计算 vma 的空洞，并更新到根的路径
+static void vma_gap_update(struct vm_area_struct *vma)
+{
+    vma->vm_gap = vma_free_gap(vma, vma->vm_prev ? vma->vm_prev->vm_end : USER_START);
+    rb_augment_path(&vma->vm_rb, vma_augment);
+}
+
+void stack_limit_write(uint64_t pages)
+{
+    // 栈前面为增长保留的空洞随上限变化，已有进程的栈 VMA 也要重新计算
+    for (uint64_t pid = 1; pid < NR_TASKS; pid++)
+    {
+        struct task_struct *t = task[pid];
+        // vfork 的父进程阻塞时 VMA 在子进程的 mm 中
+        if (!t || t->state != TASK_RUNNING)
+            continue;
+        for (struct vm_area_struct *vma = t->mm.mmap; vma; vma = vma->vm_next)
+        {
+            if (vma->vm_flags & VM_GROWSDOWN)
+                vma_gap_update(vma);
+        }
+    }
+}
+
 struct vm_area_struct *find_vma(struct mm_struct *mm, uint64_t addr)
 {
-    struct vm_area_struct *vma = mm->mmap;
-    while (vma != NULL)
+    // 连续的缺页通常落在同几个 VMA 中，先查缓存
+    for (int i = 0; i < VMACACHE_SIZE; i++)
+    {
+        struct vm_area_struct *vma = mm->vmacache[i];
+        if (vma && addr >= vma->vm_start && addr < vma->vm_end)
+            return vma;
+    }
+    struct rb_node *node = mm->mm_rb.rb_node;
+    while (node)
     {
-        if (addr >= vma->vm_start && addr < vma->vm_end)
+        struct vm_area_struct *vma = rb_entry(node, struct vm_area_struct, vm_rb);
+        if (addr < vma->vm_start)
+            node = node->rb_left;
+        else if (addr >= vma->vm_end)
+            node = node->rb_right;
+        else
         {
+            mm->vmacache[VMACACHE_HASH(addr)] = vma;
             return vma;
         }
-        vma = vma->vm_next;
     }
     return NULL;
 }
 
+// 在 node 的子树中按地址顺序找第一个满足条件的 VMA：它前面的空洞与 [low, ...) 的交集不小于 len
+static struct vm_area_struct *find_gap(struct rb_node *node, uint64_t low, uint64_t len)
+{
+    if (!node)
+        return NULL;
+    struct vm_area_struct *vma = rb_entry(node, struct vm_area_struct, vm_rb);
+    if (vma->vm_max_gap < len)
+        return NULL;
+    // 左子树的 VMA 都在 vma 之前，vma->vm_start 都不够高时左子树不可能满足
+    if (vma->vm_start >= low + len)
+    {
+        struct vm_area_struct *found = find_gap(node->rb_left, low, len);
+        if (found)
+            return found;
+        uint64_t gap_start = vma->vm_prev ? vma->vm_prev->vm_end : USER_START;
+        uint64_t gap_end = gap_start + vma->vm_gap;
+        if (gap_start < low)
+            gap_start = low;
+        if (gap_end > gap_start && gap_end - gap_start >= len)
+            return vma;
+    }
+    return find_gap(node->rb_right, low, len);
+}
+
+uint64_t get_unmapped_area(struct mm_struct *mm, uint64_t low, uint64_t len)
+{
+    low = PGROUNDUP(low);
+    len = PGROUNDUP(len);
+    if (len == 0 || low >= USER_END || len > USER_END - low)
+        return -1;
+    struct vm_area_struct *vma = find_gap(mm->mm_rb.rb_node, low, len);
+    if (vma)
+    {
+        uint64_t gap_start = vma->vm_prev ? vma->vm_prev->vm_end : USER_START;
+        return gap_start > low ? gap_start : low;
+    }
+    // 最后一个 VMA 之后到 USER_END 的空间
+    struct rb_node *last = rb_last(&mm->mm_rb);
+    uint64_t start = last ? rb_entry(last, struct vm_area_struct, vm_rb)->vm_end : USER_START;
+    if (start < low)
+        start = low;
+    return USER_END - start >= len ? start : (uint64_t)-1;
+}
+
 uint64_t do_mmap(struct mm_struct *mm, uint64_t addr, uint64_t len, uint64_t vm_pgoff, uint64_t vm_filesz, uint64_t flags)
 {
 #ifdef DEBUG
@@ -228,32 +456,41 @@ uint64_t do_mmap(struct mm_struct *mm, uint64_t addr, uint64_t len, uint64_t vm_
     // vm_pgoff -= start_off;
     // vm_filesz += start_off;
 
-    struct vm_area_struct *vma = mm->mmap;
+    // 沿红黑树下降找插入位置；VMA 互不重叠，若与某个 VMA 重叠一定会在路径上遇到
+    struct rb_node **link = &mm->mm_rb.rb_node, *parent = NULL;
     struct vm_area_struct *prev = NULL;
-    while (vma != NULL)
+    while (*link)
     {
-        if (addr + len > vma->vm_start && addr < vma->vm_end)
+        parent = *link;
+        struct vm_area_struct *vma = rb_entry(parent, struct vm_area_struct, vm_rb);
+        if (addr + len <= vma->vm_start)
+            link = &parent->rb_left;
+        else if (addr >= vma->vm_end)
         {
-            // 请求的内存区域包含于已有的 VMA 中
-            return -1;
+            prev = vma;
+            link = &parent->rb_right;
         }
-        if (addr < vma->vm_start)
+        else
         {
-            // 请求的内存区域的起始地址位于已有的 VMA 之前
-            break;
+            // 请求的内存区域与已有的 VMA 重叠
+            return -1;
         }
-        prev = vma;
-        vma = vma->vm_next;
     }
+    struct vm_area_struct *next = prev ? prev->vm_next : mm->mmap;
     struct vm_area_struct *new_vma = (struct vm_area_struct *)kalloc();
+    if (!new_vma)
+        return -1;
+    nr_vmas++;
     new_vma->vm_mm = mm;
     new_vma->vm_start = addr;
     new_vma->vm_end = addr + len;
-    new_vma->vm_next = vma;
+    new_vma->vm_next = next;
     new_vma->vm_prev = prev;
     new_vma->vm_flags = flags;
     new_vma->vm_pgoff = vm_pgoff;
     new_vma->vm_filesz = vm_filesz;
+    new_vma->vm_file = NULL;
+    memset(&new_vma->vm_wss, 0, sizeof(new_vma->vm_wss));
     if (prev != NULL)
     {
         prev->vm_next = new_vma;
@@ -262,9 +499,542 @@ uint64_t do_mmap(struct mm_struct *mm, uint64_t addr, uint64_t len, uint64_t vm_
     {
         mm->mmap = new_vma;
     }
-    if (vma != NULL)
+    if (next != NULL)
     {
-        vma->vm_prev = new_vma;
+        next->vm_prev = new_vma;
     }
+    new_vma->vm_gap = vma_free_gap(new_vma, prev ? prev->vm_end : USER_START);
+    rb_link_node(&new_vma->vm_rb, parent, link);
+    rb_insert_color(&new_vma->vm_rb, &mm->mm_rb, vma_augment);
+    // 新 VMA 占掉了 next 前面空洞的一部分
+    if (next != NULL)
+        vma_gap_update(next);
     return addr;
 }
+
+// 单页刷新的上限，超过后直接刷新整个 TLB
+#define FLUSH_TLB_MAX_PAGES 64
+
+void flush_tlb_page(struct mm_struct *mm, uint64_t va)
+{
+    asm volatile("sfence.vma %0, %1" : : "r"(va), "r"(mm->asid) : "memory");
+}
+
+void flush_tlb_range(struct mm_struct *mm, uint64_t start, uint64_t end)
+{
+    if (end - start > FLUSH_TLB_MAX_PAGES * PGSIZE)
+    {
+        flush_tlb_mm(mm);
+        return;
+    }
+    for (uint64_t va = start; va < end; va += PGSIZE)
+        flush_tlb_page(mm, va);
+}
+
+void flush_tlb_mm(struct mm_struct *mm)
+{
+    asm volatile("sfence.vma zero, %0" : : "r"(mm->asid) : "memory");
+}
+
+void flush_tlb_all(void)
+{
+    asm volatile("sfence.vma zero, zero" : : : "memory");
+}
+
+void switch_mm(struct task_struct *next)
+{
+    // 各地址空间的 TLB 项由 ASID 区分，切换时不需要刷新
+    csr_write(satp, SATP_PPN(VA2PA((uint64_t)next->pgd)) | SATP_ASID(next->mm.asid) | SATP_SV39);
+}
+
+struct file *vma_file_dup(struct file *file)
+{
+    struct file *copy = (struct file *)kalloc();
+    if (copy)
+        memcpy(copy, file, sizeof(struct file));
+    return copy;
+}
+
+// 第一个 vm_end > addr 的 VMA
+static struct vm_area_struct *find_vma_from(struct mm_struct *mm, uint64_t addr)
+{
+    struct vm_area_struct *found = NULL;
+    struct rb_node *node = mm->mm_rb.rb_node;
+    while (node)
+    {
+        struct vm_area_struct *vma = rb_entry(node, struct vm_area_struct, vm_rb);
+        if (addr < vma->vm_end)
+        {
+            found = vma;
+            if (addr >= vma->vm_start)
+                break;
+            node = node->rb_left;
+        }
+        else
+            node = node->rb_right;
+    }
+    return found;
+}
+
+// 把栈的下端扩展到 addr 所在的页
+static int expand_stack(struct vm_area_struct *vma, uint64_t addr)
+{
+    uint64_t start = PGROUNDDOWN(addr);
+    if (!(vma->vm_flags & VM_GROWSDOWN) || vma->vm_end - start > stack_limit_pages * PGSIZE)
+        return -1;
+    uint64_t prev_end = vma->vm_prev ? vma->vm_prev->vm_end : USER_START;
+    if (start < prev_end || start - prev_end < STACK_GUARD_GAP)
+        return -1;
+#ifdef DEBUG
+    Log("expand stack %lx -> %lx", vma->vm_start, start);
+#endif
+    // 下端只在与前一个 VMA 之间的空洞里移动，树中的顺序不变
+    vma->vm_start = start;
+    vma_gap_update(vma);
+    return 0;
+}
+
+struct vm_area_struct *find_extend_vma(struct mm_struct *mm, uint64_t addr)
+{
+    struct vm_area_struct *vma = find_vma_from(mm, addr);
+    if (!vma || addr >= vma->vm_start)
+        return vma;
+    return expand_stack(vma, addr) == 0 ? vma : NULL;
+}
+
+// 在 addr 处把 vma 拆成两个，返回后一半
+static struct vm_area_struct *split_vma(struct mm_struct *mm, struct vm_area_struct *vma, uint64_t addr)
+{
+    uint64_t off = addr - vma->vm_start;
+    uint64_t end = vma->vm_end;
+    uint64_t filesz = vma->vm_filesz > off ? vma->vm_filesz - off : 0;
+    vma->vm_end = addr;
+    if (vma->vm_filesz > off)
+        vma->vm_filesz = off;
+    // 缩短后空出的 [addr, end) 马上被新 VMA 占据，后面 VMA 的空洞不变
+    if (do_mmap(mm, addr, end - addr, vma->vm_pgoff + off, filesz, vma->vm_flags) != addr)
+    {
+        Err("out of memory");
+    }
+    struct vm_area_struct *new_vma = vma->vm_next;
+    if (vma->vm_file && !(new_vma->vm_file = vma_file_dup(vma->vm_file)))
+    {
+        Err("out of memory");
+    }
+    return new_vma;
+}
+
+// 从链表和红黑树中摘除 vma 并释放，不处理其中的页
+static void remove_vma(struct mm_struct *mm, struct vm_area_struct *vma)
+{
+    struct vm_area_struct *prev = vma->vm_prev, *next = vma->vm_next;
+    if (prev)
+        prev->vm_next = next;
+    else
+        mm->mmap = next;
+    if (next)
+        next->vm_prev = prev;
+    rb_erase(&vma->vm_rb, &mm->mm_rb, vma_augment);
+    if (next)
+        vma_gap_update(next);
+    for (int i = 0; i < VMACACHE_SIZE; i++)
+    {
+        if (mm->vmacache[i] == vma)
+            mm->vmacache[i] = NULL;
+    }
+    if (vma->vm_file)
+        put_page(vma->vm_file);
+    nr_vmas--;
+    put_page(vma);
+}
+
+// 相邻、权限相同的匿名 VMA 合并到 prev 中
+static void try_merge_vma(struct mm_struct *mm, struct vm_area_struct *prev)
+{
+    struct vm_area_struct *next = prev->vm_next;
+    if (!next || prev->vm_end != next->vm_start || prev->vm_flags != next->vm_flags)
+        return;
+    if (!(prev->vm_flags & VM_ANON) || prev->vm_file || next->vm_file)
+        return;
+    prev->vm_end = next->vm_end;
+    remove_vma(mm, next);
+}
+
+// 共享的文件映射在解除映射前把被写过的页写回文件
+static void writeback_page(struct vm_area_struct *vma, uint64_t va, uint64_t pte)
+{
+    if (!vma->vm_file || !(vma->vm_flags & VM_SHARED) || !(pte & PTE_D))
+        return;
+    uint64_t off = va - vma->vm_start;
+    if (off >= vma->vm_filesz)
+        return;
+    uint64_t len = vma->vm_filesz - off < PGSIZE ? vma->vm_filesz - off : PGSIZE;
+    vma->vm_file->lseek(vma->vm_file, vma->vm_pgoff + off, SEEK_SET);
+    vma->vm_file->write(vma->vm_file, (void *)PTE2VA(pte), len);
+}
+
+// 返回 va 所在 2 MiB 区域的末级页表在上一级页表中的页表项，没有末级页表（或是大页）时返回 NULL
+static uint64_t *find_pte_table(uint64_t *pgtbl, uint64_t va)
+{
+    if (!PTE_IS_VALID(pgtbl[VA2VPN2(va)]))
+        return NULL;
+    uint64_t *pgtbl1 = (uint64_t *)PTE2VA(pgtbl[VA2VPN2(va)]);
+    uint64_t *pte_p = &pgtbl1[VA2VPN1(va)];
+    if (!PTE_IS_VALID(*pte_p) || PTE_IS_LEAF(*pte_p))
+        return NULL;
+    return pte_p;
+}
+
+int unshare_pte_table(struct mm_struct *mm, uint64_t *pgtbl, uint64_t va)
+{
+    uint64_t *pte_p = find_pte_table(pgtbl, va);
+    if (!pte_p || get_page_refcnt((void *)PTE2VA(*pte_p)) <= 1)
+        return 0;
+    uint64_t *new_pgtbl0 = (uint64_t *)kalloc();
+    if (!new_pgtbl0)
+        return -1;
+    uint64_t *old_pgtbl0 = (uint64_t *)PTE2VA(*pte_p); // kalloc 可能换出页面，之后再读旧页表
+    for (uint64_t i = 0; i < PGSIZE / sizeof(uint64_t); i++)
+    {
+        uint64_t pte = old_pgtbl0[i];
+        if (IS_SWAP_PTE(pte))
+            swap_dup(pte);
+        else if (pte)
+            get_page((void *)PTE2VA(pte));
+        new_pgtbl0[i] = pte;
+    }
+    *pte_p = VA2PTE((uint64_t)new_pgtbl0) | PTE_V;
+    put_page(old_pgtbl0);
+    // 改动了非叶子页表项
+    flush_tlb_mm(mm);
+#ifdef DEBUG
+    Log("unshare pte table %lx -> %lx at va %lx", old_pgtbl0, new_pgtbl0, va);
+#endif
+    return 0;
+}
+
+// 末级页表被共享时只解除本地址空间对它的引用，返回 1；没有共享返回 0
+static int drop_shared_pte_table(struct mm_struct *mm, uint64_t *pgtbl, uint64_t va)
+{
+    uint64_t *pte_p = find_pte_table(pgtbl, va);
+    if (!pte_p || get_page_refcnt((void *)PTE2VA(*pte_p)) <= 1)
+        return 0;
+    put_page((void *)PTE2VA(*pte_p));
+    *pte_p = 0;
+    flush_tlb_mm(mm);
+    return 1;
+}
+
+// 清除 vma 中 [start, end) 的页表项，释放对应的物理页和 swap slot；拆分大页或复制共享的末级页表时内存不足返回 -ENOMEM
+static int zap_range(struct vm_area_struct *vma, uint64_t *pgtbl, uint64_t start, uint64_t end)
+{
+    uint64_t va = start;
+    while (va < end)
+    {
+        uint64_t *huge_pte_p = find_huge_pte(pgtbl, va);
+        if (huge_pte_p)
+        {
+            if (va == HPGROUNDDOWN(va) && va + HPAGE_SIZE <= end)
+            {
+                for (uint64_t i = 0; i < HPAGE_NR; i++)
+                {
+                    writeback_page(vma, va + i * PGSIZE, *huge_pte_p + (i << 10));
+                    put_page((void *)(PTE2VA(*huge_pte_p) + i * PGSIZE));
+                }
+                *huge_pte_p = 0;
+                va += HPAGE_SIZE;
+                continue;
+            }
+            if (split_huge_mapping(pgtbl, va) != 0)
+                return -ENOMEM;
+        }
+        if (va == start || va == HPGROUNDDOWN(va))
+        {
+            // 整个 2 MiB 都被清除时，共享的末级页表只需减少引用；否则先复制一份私有的
+            if (va == HPGROUNDDOWN(va) && va + HPAGE_SIZE <= end && drop_shared_pte_table(vma->vm_mm, pgtbl, va))
+            {
+                va += HPAGE_SIZE;
+                continue;
+            }
+            if (unshare_pte_table(vma->vm_mm, pgtbl, va) != 0)
+                return -ENOMEM;
+        }
+        uint64_t *pte_p = find_pte(pgtbl, va);
+        if (!pte_p)
+        {
+            // 没有末级页表，整个 2 MiB 都没有映射
+            va = HPGROUNDDOWN(va) + HPAGE_SIZE;
+            continue;
+        }
+        uint64_t pte = *pte_p;
+        if (IS_SWAP_PTE(pte))
+            swap_free(pte);
+        else if (PTE_IS_PRESENT(pte))
+        {
+            writeback_page(vma, va, pte);
+            put_page((void *)PTE2VA(pte));
+        }
+        *pte_p = 0;
+        va += PGSIZE;
+    }
+    return 0;
+}
+
+// 返回 pgtbl[idx] 指向的下一级页表，没有则分配一张清零的页表，内存不足时返回 NULL
+static uint64_t *pgtbl_next_alloc(uint64_t *pgtbl, uint64_t idx)
+{
+    if (!PTE_IS_VALID(pgtbl[idx]))
+    {
+        uint64_t *new_pgtbl = (uint64_t *)kalloc();
+        if (!new_pgtbl)
+            return NULL;
+        memset(new_pgtbl, 0x0, PGSIZE);
+        pgtbl[idx] = VA2PTE((uint64_t)new_pgtbl) | PTE_V;
+    }
+    return (uint64_t *)PTE2VA(pgtbl[idx]);
+}
+
+int copy_page_range(uint64_t *dst, uint64_t *src, uint64_t start, uint64_t end, uint64_t cow_mask)
+{
+    uint64_t va = start;
+    while (va < end)
+    {
+        uint64_t vpn2 = VA2VPN2(va);
+        uint64_t end1 = ((va >> 30) + 1) << 30;
+        if (!PTE_IS_VALID(src[vpn2]))
+        {
+            // 整个 1 GiB 都没有映射
+            va = end1;
+            continue;
+        }
+        if (end1 > end)
+            end1 = end;
+        uint64_t *src1 = (uint64_t *)PTE2VA(src[vpn2]);
+        uint64_t *dst1 = pgtbl_next_alloc(dst, vpn2);
+        if (!dst1)
+            return -1;
+        for (; va < end1; va = HPGROUNDDOWN(va) + HPAGE_SIZE)
+        {
+            uint64_t vpn1 = VA2VPN1(va);
+            if (!PTE_IS_VALID(src1[vpn1]))
+                continue;
+            if (PTE_IS_LEAF(src1[vpn1]))
+            {
+                // 2 MiB 大页不会跨越 VMA 边界，整页复制叶子项，每个 4 KiB 页的引用计数加一
+                for (uint64_t i = 0; i < HPAGE_NR; i++)
+                    get_page((void *)(PTE2VA(src1[vpn1]) + i * PGSIZE));
+                src1[vpn1] &= cow_mask;
+                dst1[vpn1] = src1[vpn1];
+                continue;
+            }
+            uint64_t *src0 = (uint64_t *)PTE2VA(src1[vpn1]);
+            uint64_t end0 = HPGROUNDDOWN(va) + HPAGE_SIZE < end1 ? HPGROUNDDOWN(va) + HPAGE_SIZE : end1;
+            if (!PTE_IS_VALID(dst1[vpn1]))
+            {
+                // 子进程直接共享父进程的末级页表，页表页的引用计数加一，第一次修改时再复制（unshare_pte_table）
+                get_page(src0);
+                dst1[vpn1] = src1[vpn1];
+            }
+            if (PTE2VA(dst1[vpn1]) == (uint64_t)src0)
+            {
+                // 共享的页表中，本 VMA 范围内的页表项去掉写权限；物理页仍然只被这一张页表引用
+                for (uint64_t i = VA2VPN0(va), last = VA2VPN0(end0 - PGSIZE); i <= last; i++)
+                {
+                    if (!IS_SWAP_PTE(src0[i]))
+                        src0[i] &= cow_mask;
+                }
+                continue;
+            }
+            uint64_t *dst0 = pgtbl_next_alloc(dst1, vpn1);
+            if (!dst0)
+                return -1;
+            for (uint64_t i = VA2VPN0(va), last = VA2VPN0(end0 - PGSIZE); i <= last; i++)
+            {
+                uint64_t pte = src0[i];
+                if (!pte)
+                    continue;
+                if (IS_SWAP_PTE(pte))
+                    swap_dup(pte); // 已换出的页：复制 swap entry，slot 的引用计数加一
+                else
+                {
+                    get_page((void *)PTE2VA(pte));
+                    pte &= cow_mask;
+                    src0[i] = pte;
+                }
+                dst0[i] = pte;
+            }
+        }
+    }
+    return 0;
+}
+
+int do_munmap(struct mm_struct *mm, uint64_t *pgtbl, uint64_t start, uint64_t len)
+{
+    if ((start & (PGSIZE - 1)) || len == 0 || start >= USER_END || len > USER_END - start)
+        return -EINVAL;
+    uint64_t end = start + PGROUNDUP(len);
+    struct vm_area_struct *vma = find_vma_from(mm, start);
+    while (vma && vma->vm_start < end)
+    {
+        if (vma->vm_start < start)
+        {
+            vma = split_vma(mm, vma, start);
+            continue;
+        }
+        if (vma->vm_end > end)
+            split_vma(mm, vma, end);
+        struct vm_area_struct *next = vma->vm_next;
+        if (zap_range(vma, pgtbl, vma->vm_start, vma->vm_end) != 0)
+        {
+            // 已经清除的页表项之后缺页时重新填充，VMA 保留
+            flush_tlb_range(mm, start, end);
+            return -ENOMEM;
+        }
+        remove_vma(mm, vma);
+        vma = next;
+    }
+    flush_tlb_range(mm, start, end);
+    return 0;
+}
+
+void exit_mmap(struct mm_struct *mm, uint64_t *pgtbl)
+{
+    // 整个地址空间都要释放：仍被共享的末级页表直接解除引用，不必先复制一份私有的再清空
+    for (uint64_t vpn2 = VA2VPN2(USER_START); vpn2 <= VA2VPN2(USER_END - 1); vpn2++)
+    {
+        if (!PTE_IS_VALID(pgtbl[vpn2]) || PTE_IS_LEAF(pgtbl[vpn2]))
+            continue;
+        for (uint64_t vpn1 = 0; vpn1 < PGSIZE / sizeof(uint64_t); vpn1++)
+            drop_shared_pte_table(mm, pgtbl, (vpn2 << 30) | (vpn1 << 21));
+    }
+    do_munmap(mm, pgtbl, USER_START, USER_END - USER_START);
+    // 页表项都已清空，共享的末级页表也已解除引用，剩下的页表页都属于这个地址空间
+    for (uint64_t vpn2 = VA2VPN2(USER_START); vpn2 <= VA2VPN2(USER_END - 1); vpn2++)
+    {
+        if (!PTE_IS_VALID(pgtbl[vpn2]) || PTE_IS_LEAF(pgtbl[vpn2]))
+            continue;
+        uint64_t *pgtbl1 = (uint64_t *)PTE2VA(pgtbl[vpn2]);
+        for (uint64_t vpn1 = 0; vpn1 < PGSIZE / sizeof(uint64_t); vpn1++)
+        {
+            if (PTE_IS_VALID(pgtbl1[vpn1]) && !PTE_IS_LEAF(pgtbl1[vpn1]))
+                put_page((void *)PTE2VA(pgtbl1[vpn1]));
+        }
+        put_page(pgtbl1);
+        pgtbl[vpn2] = 0;
+    }
+    flush_tlb_mm(mm);
+}
+
+// VMA 权限对应的页表项权限位，为 0 表示不可访问
+static uint64_t vm_prot_pte(uint64_t vm_flags)
+{
+    return ((vm_flags & (VM_READ | VM_WRITE)) ? PTE_R : 0) | ((vm_flags & VM_EXEC) ? PTE_X : 0);
+}
+
+/*
+ * 修改页表项之前拆开 vma 中不能整体改为 perm 的大页（跨出 vma，或要改为不可访问），并复制共享的末级页表。
+ * 只改变页表的形状、不改变权限，内存不足时返回 -ENOMEM，调用者可以直接放弃。
+ */
+static int prepare_pte_range(struct vm_area_struct *vma, uint64_t *pgtbl, uint64_t perm)
+{
+    for (uint64_t va = vma->vm_start; va < vma->vm_end; va = HPGROUNDDOWN(va) + HPAGE_SIZE)
+    {
+        uint64_t haddr = HPGROUNDDOWN(va);
+        if (find_huge_pte(pgtbl, va) && (!perm || haddr < vma->vm_start || haddr + HPAGE_SIZE > vma->vm_end) && split_huge_mapping(pgtbl, va) != 0)
+            return -ENOMEM;
+        if (unshare_pte_table(vma->vm_mm, pgtbl, va) != 0)
+            return -ENOMEM;
+    }
+    return 0;
+}
+
+/*
+ * 按 vma 的新权限修改已有的页表项。PTE_W 一律清除，由缺页处理决定是直接恢复写权限还是写时复制；
+ * 不可访问的页清除 PTE_V、置 PTE_PROT_NONE，物理页保留在页表项中。
+ * 剩下的大页都完整地落在 vma 中，末级页表都是私有的（见 prepare_pte_range）。
+ */
+static void change_pte_range(struct vm_area_struct *vma, uint64_t *pgtbl)
+{
+    uint64_t perm = vm_prot_pte(vma->vm_flags);
+    uint64_t va = vma->vm_start;
+    while (va < vma->vm_end)
+    {
+        uint64_t *huge_pte_p = find_huge_pte(pgtbl, va);
+        if (huge_pte_p)
+        {
+            *huge_pte_p = (*huge_pte_p & ~(PTE_R | PTE_W | PTE_X)) | perm;
+            va = HPGROUNDDOWN(va) + HPAGE_SIZE;
+            continue;
+        }
+        uint64_t *pte_p = find_pte(pgtbl, va);
+        if (!pte_p)
+        {
+            va = HPGROUNDDOWN(va) + HPAGE_SIZE;
+            continue;
+        }
+        uint64_t pte = *pte_p;
+        if (PTE_IS_PRESENT(pte))
+        {
+            pte &= ~(PTE_R | PTE_W | PTE_X | PTE_V | PTE_PROT_NONE);
+            // 没有任何权限时保留 PTE_R，使其仍然可以被识别为叶子项
+            *pte_p = perm ? pte | perm | PTE_V : pte | PTE_R | PTE_PROT_NONE;
+        }
+        va += PGSIZE;
+    }
+}
+
+int do_mprotect(struct mm_struct *mm, uint64_t *pgtbl, uint64_t start, uint64_t len, uint64_t vm_prot)
+{
+    if ((start & (PGSIZE - 1)) || len == 0 || start >= USER_END || len > USER_END - start)
+        return -EINVAL;
+    uint64_t end = start + PGROUNDUP(len);
+    struct vm_area_struct *first = find_vma_from(mm, start);
+    // 区间中不能有空洞
+    uint64_t addr = start;
+    for (struct vm_area_struct *vma = first; addr < end; vma = vma->vm_next)
+    {
+        if (!vma || vma->vm_start > addr)
+            return -ENOMEM;
+        // 只读打开的文件的共享映射不能改为可写，否则写入会被写回文件
+        if ((vm_prot & VM_WRITE) && (vma->vm_flags & VM_SHARED) && !(vma->vm_flags & VM_MAYWRITE))
+            return -EACCES;
+        addr = vma->vm_end;
+    }
+    // 先在边界拆分 VMA、拆开大页、复制共享的末级页表，这些都不改变权限；内存不足时还没有任何页改了权限，直接返回
+    int ret = 0;
+    struct vm_area_struct *vma = first;
+    while (vma && vma->vm_start < end)
+    {
+        if (vma->vm_start < start)
+        {
+            vma = split_vma(mm, vma, start);
+            continue;
+        }
+        if (vma->vm_end > end)
+            split_vma(mm, vma, end);
+        if (prepare_pte_range(vma, pgtbl, vm_prot_pte(vm_prot)) != 0)
+        {
+            ret = -ENOMEM;
+            break;
+        }
+        vma = vma->vm_next;
+    }
+    for (vma = find_vma_from(mm, start); ret == 0 && vma && vma->vm_start < end; vma = vma->vm_next)
+    {
+        vma->vm_flags = (vma->vm_flags & ~(VM_READ | VM_WRITE | VM_EXEC)) | vm_prot;
+        change_pte_range(vma, pgtbl);
+    }
+    // 把拆开的 VMA 与两侧权限相同的重新合并
+    vma = find_vma_from(mm, start);
+    if (vma && vma->vm_prev)
+        vma = vma->vm_prev;
+    while (vma && vma->vm_start <= end)
+    {
+        struct vm_area_struct *next = vma->vm_next;
+        try_merge_vma(mm, vma);
+        if (vma->vm_next == next)
+            vma = next;
+    }
+    flush_tlb_range(mm, start, end);
+    return ret;
+}
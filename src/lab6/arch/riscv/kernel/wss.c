@@ -0,0 +1,140 @@
+#include "wss.h"
+#include "defs.h"
+#include "mm.h"
+#include "vm.h"
+#include "proc.h"
+#include "string.h"
+
+uint64_t wss_scan_interval = WSS_SCAN_INTERVAL;
+uint64_t nr_wss_scans;
+static uint64_t wss_ticks;
+
+/*
+ * 每个物理页自上一次被访问以来经过的扫描轮数（age），以及最后一次更新 age 时的轮数（gen）。
+ * 一个页可能被多个页表映射，gen 保证它在一轮扫描中只增长一次。
+ */
+struct page_idle
+{
+    uint8_t age;
+    uint8_t gen;
+};
+
+static struct page_idle *page_idle;
+static int a_cleared; // 这一轮扫描当前进程时清除过 A 位
+
+void wss_init(void)
+{
+    uint64_t size = PGROUNDUP(buddy_total_pages() * sizeof(struct page_idle));
+    page_idle = (struct page_idle *)alloc_pages(size / PGSIZE);
+    if (page_idle)
+        memset(page_idle, 0, size);
+}
+
+int page_recently_accessed(void *page)
+{
+    if (!wss_scan_interval || !page_idle || !nr_wss_scans)
+        return 0;
+    struct page_idle *p = &page_idle[PHYS2PFN(VA2PA((uint64_t)page))];
+    return p->gen == (uint8_t)nr_wss_scans && p->age == 0;
+}
+
+void wss_migrate_page(void *old_page, void *new_page)
+{
+    if (page_idle)
+        page_idle[PHYS2PFN(VA2PA((uint64_t)new_page))] = page_idle[PHYS2PFN(VA2PA((uint64_t)old_page))];
+}
+
+// 读取并清除页表项的 A 位，返回更新后的 age
+static uint64_t scan_pte(uint64_t *pte_p)
+{
+    struct page_idle *p = &page_idle[PHYS2PFN(PTE2PA(*pte_p))];
+    uint8_t gen = (uint8_t)nr_wss_scans;
+    if (*pte_p & PTE_A)
+    {
+        *pte_p &= ~PTE_A;
+        p->age = 0;
+        a_cleared = 1;
+    }
+    else if (p->gen != gen && p->age < 255)
+        p->age++;
+    p->gen = gen;
+    return p->age;
+}
+
+// age 0 表示最近一轮被访问过（工作集），之后按 1、2-3、4-7、8 轮以上分桶
+static void account_page(struct wss_stat *stat, uint64_t age, uint64_t pte, uint64_t nr)
+{
+    uint64_t bucket = 0;
+    for (; age && bucket < WSS_NR_BUCKETS - 1; age >>= 1)
+        bucket++;
+    stat->idle[bucket] += nr;
+    if (pte & PTE_D)
+        stat->dirty += nr;
+}
+
+// 和 print_pgtbl 一样逐级走页表，没有下级页表的区间整段跳过
+static void scan_vma(uint64_t *pgtbl, struct vm_area_struct *vma)
+{
+    memset(&vma->vm_wss, 0, sizeof(vma->vm_wss));
+    uint64_t va = vma->vm_start;
+    while (va < vma->vm_end)
+    {
+        uint64_t pte2 = pgtbl[VA2VPN2(va)];
+        if (!PTE_IS_VALID(pte2))
+        {
+            va = (va | ((1UL << 30) - 1)) + 1;
+            continue;
+        }
+        uint64_t *pte1_p = &((uint64_t *)PTE2VA(pte2))[VA2VPN1(va)];
+        uint64_t end = HPGROUNDDOWN(va) + HPAGE_SIZE < vma->vm_end ? HPGROUNDDOWN(va) + HPAGE_SIZE : vma->vm_end;
+        if (!PTE_IS_VALID(*pte1_p))
+        {
+            va = end;
+            continue;
+        }
+        if (PTE_IS_LEAF(*pte1_p))
+        {
+            // 大页只有一个 A 位，整体计入 VMA 中的那部分
+            account_page(&vma->vm_wss, scan_pte(pte1_p), *pte1_p, (end - va) / PGSIZE);
+            va = end;
+            continue;
+        }
+        uint64_t *pgtbl0 = (uint64_t *)PTE2VA(*pte1_p);
+        // fork 后共享的末级页表中的 A 位可能已经在扫描另一个地址空间时清除，这个地址空间的 TLB 同样要刷新
+        if (get_page_refcnt(pgtbl0) > 1)
+            a_cleared = 1;
+        for (; va < end; va += PGSIZE)
+        {
+            uint64_t *pte_p = &pgtbl0[VA2VPN0(va)];
+            if (PTE_IS_VALID(*pte_p))
+                account_page(&vma->vm_wss, scan_pte(pte_p), *pte_p, 1);
+        }
+    }
+}
+
+void wss_tick(void)
+{
+    if (!wss_scan_interval || !page_idle || ++wss_ticks < wss_scan_interval)
+        return;
+    wss_ticks = 0;
+    nr_wss_scans++;
+    for (uint64_t pid = 1; pid < NR_TASKS; pid++)
+    {
+        struct task_struct *t = task[pid];
+        // vfork 的父进程阻塞时 mm 在子进程那里
+        if (!t || t->state != TASK_RUNNING || !t->pgd)
+            continue;
+        memset(&t->wss, 0, sizeof(t->wss));
+        a_cleared = 0;
+        for (struct vm_area_struct *vma = t->mm.mmap; vma; vma = vma->vm_next)
+        {
+            scan_vma(t->pgd, vma);
+            for (int i = 0; i < WSS_NR_BUCKETS; i++)
+                t->wss.idle[i] += vma->vm_wss.idle[i];
+            t->wss.dirty += vma->vm_wss.dirty;
+        }
+        // TLB 中缓存的页表项 A 位仍然是 1，不刷新的话之后的访问不会再置位
+        if (a_cleared)
+            flush_tlb_mm(&t->mm);
+    }
+}
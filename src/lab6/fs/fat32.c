@@ -4,6 +4,7 @@
 #include "string.h"
 #include "mbr.h"
 #include "mm.h"
+#include "pagecache.h"
 
 struct fat32_bpb fat32_header;
 struct fat32_volume fat32_volume;
@@ -25,9 +26,15 @@ uint32_t next_cluster(uint64_t cluster)
 {
     uint64_t fat_offset = cluster * 4;
     uint64_t fat_sector = fat32_volume.first_fat_sec + fat_offset / VIRTIO_BLK_SECTOR_SIZE;
-    virtio_blk_read_sector(fat_sector, fat32_table_buf);
-    int index_in_sector = fat_offset % (VIRTIO_BLK_SECTOR_SIZE / sizeof(uint32_t));
-    return *(uint32_t *)(fat32_table_buf + index_in_sector);
+    // 沿簇链前进时通常落在同一个 FAT 扇区中；FAT 表不会被修改，可以直接复用上一次读到的扇区
+    static uint64_t cached_fat_sector;
+    if (fat_sector != cached_fat_sector)
+    {
+        virtio_blk_read_sector(fat_sector, fat32_table_buf);
+        cached_fat_sector = fat_sector;
+    }
+    int offset_in_sector = fat_offset % VIRTIO_BLK_SECTOR_SIZE;
+    return *(uint32_t *)(fat32_table_buf + offset_in_sector) & 0x0fffffff; // 高 4 位保留
 }
 
 void fat32_init(uint64_t lba, uint64_t size)
@@ -145,8 +152,9 @@ struct fat32_file fat32_open_file(const char *path)
             if (strcmp(name, true_name) == 0)
             {
                 Log("file found");
-                file.cluster = dir_entry[j].startlow;
+                file.cluster = dir_entry[j].startlow | ((uint32_t)dir_entry[j].starthi << 16);
                 file.dir = (struct fat32_dir){.cluster = sector_to_cluster(root_dir_sec + i), .index = j};
+                file.size = dir_entry[j].size;
                 return file;
             }
         }
@@ -169,9 +177,7 @@ int64_t fat32_lseek(struct file *file, int64_t offset, uint64_t whence)
     else if (whence == SEEK_END)
     {
         // The file offset is set to the size of the file plus offset bytes.
-        struct fat32_dir_entry* dir_entries = (struct fat32_dir_entry*)fat32_buf;
-        virtio_blk_read_sector(cluster_to_sector(file->fat32_file.dir.cluster), fat32_buf);
-        file->cfo = dir_entries[file->fat32_file.dir.index].size + offset;
+        file->cfo = file->fat32_file.size + offset;
     }
     else
     {
@@ -187,95 +193,163 @@ uint64_t fat32_table_sector_of_cluster(uint32_t cluster)
     return fat32_volume.first_fat_sec + cluster / (VIRTIO_BLK_SECTOR_SIZE / sizeof(uint32_t));
 }
 
-int64_t fat32_read(struct file *file, void *buf, uint64_t len)
+#define FAT32_CLUSTER_SIZE (fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE)
+#define FAT32_CLUSTER_EOC 0x0ffffff8 // 不小于该值的簇号表示簇链结束
+
+// 文件中第 offset 字节所在的扇区，簇链提前结束时返回 0
+static uint64_t fat32_offset_to_sector(struct fat32_file *fat32_file, uint64_t offset)
+{
+    // 记住上一次查到的位置，顺序访问时从那里继续沿簇链前进，而不是每次从文件开头走起
+    static uint64_t last_file, last_nr, last_cluster;
+    uint64_t nr = offset / FAT32_CLUSTER_SIZE;
+    uint64_t cluster = fat32_file->cluster, i = 0;
+    if (last_file == fat32_file->cluster && last_nr <= nr)
+    {
+        cluster = last_cluster;
+        i = last_nr;
+    }
+    for (; i < nr; i++)
+    {
+        cluster = next_cluster(cluster);
+        if (cluster < 2 || cluster >= FAT32_CLUSTER_EOC)
+            return 0;
+    }
+    last_file = fat32_file->cluster;
+    last_nr = nr;
+    last_cluster = cluster;
+    return cluster_to_sector(cluster) + offset % FAT32_CLUSTER_SIZE / VIRTIO_BLK_SECTOR_SIZE;
+}
+
+// 把页缓存中第 index 页的 [from, to) 所在的扇区写回磁盘
+static void fat32_sync_page(struct file *file, uint64_t index, void *page, uint64_t from, uint64_t to)
 {
-    Log("file->cfo = %d, len = %d", file->cfo, len);
-    /* read content to buf, and return read length */
     struct fat32_file *fat32_file = &(file->fat32_file);
-    uint64_t cluster = fat32_file->cluster;
-    uint64_t cfo = file->cfo;
-    uint64_t read_len = 0;
+    uint64_t start = index * PGSIZE;
+    uint64_t sector = 0;
+    for (uint64_t off = from / VIRTIO_BLK_SECTOR_SIZE * VIRTIO_BLK_SECTOR_SIZE; off < to; off += VIRTIO_BLK_SECTOR_SIZE)
+    {
+        if (sector == 0 || (start + off) % FAT32_CLUSTER_SIZE == 0)
+            sector = fat32_offset_to_sector(fat32_file, start + off);
+        else
+            sector++;
+        if (sector == 0)
+            return;
+        virtio_blk_write_sector(sector, page + off);
+    }
+}
 
-    // Get the directory entry to determine the file size
-    struct fat32_dir_entry *dir_entries = (struct fat32_dir_entry *)fat32_buf;
-    virtio_blk_read_sector(cluster_to_sector(fat32_file->dir.cluster), fat32_buf);
-    uint64_t file_size = dir_entries[fat32_file->dir.index].size;
+// 只在页缓存中查找文件第 index 页
+void *fat32_find_page(struct file *file, uint64_t index)
+{
+    void *page = page_cache_lookup(file->fat32_file.cluster, index);
+    if (page)
+        get_page(page);
+    return page;
+}
 
-    // Adjust len if it exceeds the file size
-    if (cfo + len > file_size)
+/*
+ * 取得文件第 index 页：不在页缓存中时直接把扇区读进新页，文件末尾之后的部分清零。
+ * 一个页中的扇区在同一个簇内时连续读取，只有跨簇时才重新查 FAT 表。
+ */
+void *fat32_get_page(struct file *file, uint64_t index)
+{
+    struct fat32_file *fat32_file = &(file->fat32_file);
+    void *page = page_cache_lookup(fat32_file->cluster, index);
+    if (page)
     {
-        len = file_size - cfo;
+        get_page(page);
+        return page;
     }
-
-    while (cfo >= fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE)
+    page = alloc_page();
+    if (!page)
+        return NULL;
+    uint64_t start = index * PGSIZE;
+    uint64_t sector = 0;
+    for (uint64_t off = 0; off < PGSIZE; off += VIRTIO_BLK_SECTOR_SIZE)
     {
-        cluster = next_cluster(cluster);
-        cfo -= fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE;
+        if (start + off >= fat32_file->size)
+        {
+            memset(page + off, 0, PGSIZE - off);
+            break;
+        }
+        if (sector == 0 || (start + off) % FAT32_CLUSTER_SIZE == 0)
+            sector = fat32_offset_to_sector(fat32_file, start + off);
+        else
+            sector++;
+        if (sector == 0)
+        {
+            memset(page + off, 0, PGSIZE - off);
+            break;
+        }
+        virtio_blk_read_sector(sector, page + off);
     }
+    // 文件最后一个扇区中超出文件大小的部分也要清零，mmap 时会被看到
+    if (start < fat32_file->size && fat32_file->size - start < PGSIZE)
+        memset(page + (fat32_file->size - start), 0, PGSIZE - (fat32_file->size - start));
+    if (page_cache_insert(fat32_file->cluster, index, page) == 0)
+        get_page(page); // 一个引用属于缓存，一个返回给调用者
+    return page;
+}
+
+int64_t fat32_read(struct file *file, void *buf, uint64_t len)
+{
+    Log("file->cfo = %d, len = %d", file->cfo, len);
+    /* read content to buf, and return read length */
+    uint64_t file_size = file->fat32_file.size;
+    if (file->cfo < 0 || file->cfo >= file_size)
+        return 0;
+    // Adjust len if it exceeds the file size
+    if (file->cfo + len > file_size)
+        len = file_size - file->cfo;
 
+    uint64_t read_len = 0;
     while (read_len < len)
     {
-        uint64_t sector = cluster_to_sector(cluster);
-        virtio_blk_read_sector(sector, fat32_buf);
-        uint64_t offset = cfo % (fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE);
-        uint64_t to_read = (len - read_len) < (fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE - offset) ? (len - read_len) : (fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE - offset);
-        memcpy(buf + read_len, fat32_buf + offset, to_read);
+        uint64_t pos = file->cfo + read_len;
+        uint64_t offset = pos % PGSIZE;
+        uint64_t to_read = len - read_len < PGSIZE - offset ? len - read_len : PGSIZE - offset;
+        void *page = fat32_get_page(file, pos / PGSIZE);
+        if (!page)
+            break;
+        memcpy(buf + read_len, page + offset, to_read);
+        put_page(page);
         read_len += to_read;
-        cfo += to_read;
-        if (cfo >= fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE)
-        {
-            cluster = next_cluster(cluster);
-            cfo -= fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE;
-        }
     }
 
     file->cfo += read_len;
     return read_len;
 }
 
+// 写穿透：先修改页缓存中的页，再把被修改的扇区写回磁盘
 int64_t fat32_write(struct file *file, const void *buf, uint64_t len)
 {
     Log("file->cfo = %d, len = %d", file->cfo, len);
     /* write content to file, and return written length */
     struct fat32_file *fat32_file = &(file->fat32_file);
-    uint64_t cluster = fat32_file->cluster;
-    uint64_t cfo = file->cfo;
-    uint64_t write_len = 0;
-
-    // Get the directory entry to determine the file size
-    struct fat32_dir_entry *dir_entries = (struct fat32_dir_entry *)fat32_buf;
-    virtio_blk_read_sector(cluster_to_sector(fat32_file->dir.cluster), fat32_buf);
-    uint64_t file_size = dir_entries[fat32_file->dir.index].size;
-
+    uint64_t file_size = fat32_file->size;
+    if (file->cfo < 0 || file->cfo >= file_size)
+        return 0;
     // Adjust len if it exceeds the file size
-    if (cfo + len > file_size)
-    {
-        len = file_size - cfo;
-    }
-
-    while (cfo >= fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE)
-    {
-        cluster = next_cluster(cluster);
-        cfo -= fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE;
-    }
+    if (file->cfo + len > file_size)
+        len = file_size - file->cfo;
 
+    uint64_t write_len = 0;
     while (write_len < len)
     {
-        uint64_t sector = cluster_to_sector(cluster);
-        virtio_blk_read_sector(sector, fat32_buf);
-        uint64_t offset = cfo % (fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE);
-        uint64_t to_write = (len - write_len) < (fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE - offset) ? (len - write_len) : (fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE - offset);
-        memcpy(fat32_buf + offset, buf + write_len, to_write);
-        virtio_blk_write_sector(sector, fat32_buf);
+        uint64_t pos = file->cfo + write_len;
+        uint64_t offset = pos % PGSIZE;
+        uint64_t to_write = len - write_len < PGSIZE - offset ? len - write_len : PGSIZE - offset;
+        void *page = fat32_get_page(file, pos / PGSIZE);
+        if (!page)
+            break;
+        // 被共享映射的页就是缓存页本身，此时内容已经在页中，跳过拷贝
+        if (page + offset != buf + write_len)
+            memcpy(page + offset, buf + write_len, to_write);
+        fat32_sync_page(file, pos / PGSIZE, page, offset, offset + to_write);
+        put_page(page);
         write_len += to_write;
-        cfo += to_write;
-        if (cfo >= fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE)
-        {
-            cluster = next_cluster(cluster);
-            cfo -= fat32_volume.sec_per_cluster * VIRTIO_BLK_SECTOR_SIZE;
-        }
     }
 
     file->cfo += write_len;
     return write_len;
-}
\ No newline at end of file
+}
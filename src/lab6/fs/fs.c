@@ -4,6 +4,8 @@
 #include "string.h"
 #include "printk.h"
 #include "fat32.h"
+#include "procfs.h"
+#include "ramfs.h"
 
 struct files_struct *file_init()
 {
@@ -41,6 +43,14 @@ uint32_t get_fs_type(const char *filename)
     {
         ret = FS_TYPE_EXT2;
     }
+    else if (memcmp(filename, "/proc/", 6) == 0)
+    {
+        ret = FS_TYPE_PROC;
+    }
+    else if (memcmp(filename, "/ramfs/", 7) == 0)
+    {
+        ret = FS_TYPE_RAMFS;
+    }
     else
     {
         ret = -1;
@@ -62,6 +72,8 @@ int32_t file_open(struct file *file, const char *path, int flags)
         file->lseek = fat32_lseek;
         file->write = fat32_write;
         file->read = fat32_read;
+        file->get_page = fat32_get_page;
+        file->find_page = fat32_find_page;
         file->fat32_file = fat32_open_file(path);
         // check if fat32_file is valid (i.e. successfully opened) and return
         if (file->fat32_file.cluster == 0)
@@ -71,6 +83,24 @@ int32_t file_open(struct file *file, const char *path, int flags)
         Log("%s opened", path);
         return 0;
     }
+    else if (file->fs_type == FS_TYPE_PROC)
+    {
+        file->lseek = procfs_lseek;
+        file->write = procfs_write;
+        file->read = procfs_read;
+        file->get_page = NULL;
+        file->find_page = NULL;
+        return procfs_open(file, path);
+    }
+    else if (file->fs_type == FS_TYPE_RAMFS)
+    {
+        file->lseek = ramfs_lseek;
+        file->write = ramfs_write;
+        file->read = ramfs_read;
+        file->get_page = ramfs_get_page;
+        file->find_page = ramfs_get_page; // 内容都在 initramfs 中，不需要读盘
+        return ramfs_open(file, path);
+    }
     else if (file->fs_type == FS_TYPE_EXT2)
     {
         printk(RED "Unsupport ext2\n" CLEAR);
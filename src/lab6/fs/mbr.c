@@ -1,6 +1,7 @@
 #include "mbr.h"
 #include "virtio.h"
 #include "fat32.h"
+#include "swap.h"
 
 uint8_t mbr_buf[VIRTIO_BLK_SECTOR_SIZE];
 struct partition_info partitions[MBR_MAX_PARTITIONS];
@@ -12,6 +13,9 @@ void mbr_init() {
         if (mbr->partition_table[i].type == 0x83) {
             uint32_t lba = mbr->partition_table[i].lba_first_sector;
             partition_init(i + 1, lba, mbr->partition_table[i].sector_count);
+        } else if (mbr->partition_table[i].type == SWAP_PARTITION_TYPE) {
+            swap_init(mbr->partition_table[i].lba_first_sector, mbr->partition_table[i].sector_count);
+            printk("...swap partition #%d init done!\n", i + 1);
         }
     }
 }
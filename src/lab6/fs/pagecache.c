@@ -0,0 +1,117 @@
+#include "pagecache.h"
+#include "defs.h"
+#include "mm.h"
+#include "stddef.h"
+#include "string.h"
+#include "printk.h"
+
+uint64_t nr_page_cache_pages;
+
+static struct page_cache_entry *buckets[PAGE_CACHE_BUCKETS];
+static struct page_cache_entry *free_entries; // 空闲的缓存项，每次从一个页中切出一批
+static uint64_t shrink_cursor;                // 下一次回收从这个桶开始
+static struct page_cache_entry **page_entry;  // 按 pfn 索引的反向指针，页不在缓存中时为 NULL
+
+#define PAGE_PFN(page) PHYS2PFN(VA2PA((uint64_t)(page)))
+
+void page_cache_init(void)
+{
+    uint64_t size = PGROUNDUP(buddy_total_pages() * sizeof(*page_entry));
+    page_entry = (struct page_cache_entry **)alloc_pages(size / PGSIZE);
+    if (!page_entry)
+        Err("page cache: out of memory");
+    memset(page_entry, 0, size);
+}
+
+static uint64_t hash(uint64_t ino, uint64_t index)
+{
+    return (ino * 31 + index) % PAGE_CACHE_BUCKETS;
+}
+
+static struct page_cache_entry *alloc_entry(void)
+{
+    if (!free_entries)
+    {
+        struct page_cache_entry *entries = (struct page_cache_entry *)alloc_page();
+        if (!entries)
+            return NULL;
+        for (uint64_t i = 0; i < PGSIZE / sizeof(struct page_cache_entry); i++)
+        {
+            entries[i].next = free_entries;
+            free_entries = &entries[i];
+        }
+    }
+    struct page_cache_entry *entry = free_entries;
+    free_entries = entry->next;
+    return entry;
+}
+
+void *page_cache_lookup(uint64_t ino, uint64_t index)
+{
+    for (struct page_cache_entry *entry = buckets[hash(ino, index)]; entry; entry = entry->next)
+    {
+        if (entry->ino == ino && entry->index == index)
+            return entry->page;
+    }
+    return NULL;
+}
+
+int page_cache_insert(uint64_t ino, uint64_t index, void *page)
+{
+    struct page_cache_entry *entry = alloc_entry();
+    if (!entry)
+        return -1;
+    uint64_t bucket = hash(ino, index);
+    entry->ino = ino;
+    entry->index = index;
+    entry->page = page;
+    entry->next = buckets[bucket];
+    buckets[bucket] = entry;
+    page_entry[PAGE_PFN(page)] = entry;
+    nr_page_cache_pages++;
+    return 0;
+}
+
+uint64_t page_cache_shrink(uint64_t nrpages)
+{
+    uint64_t freed = 0;
+    for (uint64_t i = 0; i < PAGE_CACHE_BUCKETS && freed < nrpages; i++)
+    {
+        uint64_t bucket = (shrink_cursor + i) % PAGE_CACHE_BUCKETS;
+        struct page_cache_entry **link = &buckets[bucket];
+        while (*link && freed < nrpages)
+        {
+            struct page_cache_entry *entry = *link;
+            // 仍被映射的页不能回收
+            if (get_page_refcnt(entry->page) != 1)
+            {
+                link = &entry->next;
+                continue;
+            }
+            *link = entry->next;
+            page_entry[PAGE_PFN(entry->page)] = NULL;
+            put_page(entry->page);
+            entry->next = free_entries;
+            free_entries = entry;
+            nr_page_cache_pages--;
+            freed++;
+        }
+        shrink_cursor = bucket + 1;
+    }
+    return freed;
+}
+
+struct page_cache_entry *page_cache_find_page(void *page)
+{
+    return page_entry[PAGE_PFN(page)];
+}
+
+void page_cache_migrate_page(void *old_page, void *new_page)
+{
+    struct page_cache_entry *entry = page_entry[PAGE_PFN(old_page)];
+    if (!entry)
+        return;
+    entry->page = new_page;
+    page_entry[PAGE_PFN(old_page)] = NULL;
+    page_entry[PAGE_PFN(new_page)] = entry;
+}
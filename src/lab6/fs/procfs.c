@@ -0,0 +1,390 @@
+#include "procfs.h"
+#include "printk.h"
+#include "string.h"
+#include "mm.h"
+#include "vm.h"
+#include "proc.h"
+#include "fdt.h"
+#include "virtio.h"
+#include "swap.h"
+#include "pagecache.h"
+#include "wss.h"
+#include "compact.h"
+#include "ksm.h"
+#include "errno.h"
+
+#define PROCFS_MAX_ORDER 10
+
+// 可以通过写入十进制数修改的内核参数
+struct procfs_knob
+{
+    const char *name;
+    uint64_t *value;
+    uint64_t min, max;
+    void (*write)(uint64_t value); // 写入之后调用，为 NULL 时只修改值
+};
+
+static struct procfs_knob procfs_knobs[] = {
+    {.name = "fault_around", .value = &fault_around_pages, .min = 1, .max = FAULT_AROUND_MAX},
+    {.name = "stack_limit", .value = &stack_limit_pages, .min = 1, .max = STACK_LIMIT_MAX, .write = stack_limit_write},
+    {.name = "fault_trace", .value = &fault_trace, .min = 0, .max = 1},
+    {.name = "wss_interval", .value = &wss_scan_interval, .min = 0, .max = WSS_SCAN_INTERVAL_MAX},
+    {.name = "compact", .value = &compact_order, .min = 0, .max = COMPACT_MAX_ORDER, .write = compact_knob_write},
+    {.name = "ksm_interval", .value = &ksm_scan_interval, .min = 0, .max = KSM_SCAN_INTERVAL_MAX},
+    {.name = "ksm_pages", .value = &ksm_pages_to_scan, .min = 1, .max = KSM_PAGES_TO_SCAN_MAX},
+};
+
+#define NR_PROCFS_KNOBS (sizeof(procfs_knobs) / sizeof(procfs_knobs[0]))
+
+// 名字不是十进制数时返回 -1
+static int64_t parse_pid(const char *s)
+{
+    int64_t pid = 0;
+    if (*s < '0' || *s > '9')
+        return -1;
+    for (; *s >= '0' && *s <= '9'; s++)
+    {
+        pid = pid * 10 + *s - '0';
+    }
+    return *s ? -1 : pid;
+}
+
+static struct task_struct *find_task(int64_t pid)
+{
+    if (pid < 0)
+        return NULL;
+    for (int i = 0; i < NR_TASKS; i++)
+    {
+        if (task[i] && task[i]->pid == (uint64_t)pid)
+            return task[i];
+    }
+    return NULL;
+}
+
+int32_t procfs_open(struct file *file, const char *path)
+{
+    const char *name = path + 6; // skip "/proc/"
+    if (strcmp(name, "meminfo") == 0)
+    {
+        file->procfs_file.type = PROC_MEMINFO;
+    }
+    else if (strcmp(name, "tasks") == 0)
+    {
+        file->procfs_file.type = PROC_TASKS;
+    }
+    else if (memcmp(name, "vmas/", 5) == 0 && find_task(parse_pid(name + 5)))
+    {
+        file->procfs_file.type = PROC_VMAS;
+        file->procfs_file.pid = parse_pid(name + 5);
+    }
+    else if (memcmp(name, "wss/", 4) == 0 && find_task(parse_pid(name + 4)))
+    {
+        file->procfs_file.type = PROC_WSS;
+        file->procfs_file.pid = parse_pid(name + 4);
+    }
+    else if (strcmp(name, "blkstat") == 0)
+    {
+        file->procfs_file.type = PROC_BLKSTAT;
+    }
+    else if (strcmp(name, "faults") == 0)
+    {
+        file->procfs_file.type = PROC_FAULTS;
+    }
+    else if (strcmp(name, "fraginfo") == 0)
+    {
+        file->procfs_file.type = PROC_FRAGINFO;
+    }
+    else if (strcmp(name, "numainfo") == 0)
+    {
+        file->procfs_file.type = PROC_NUMAINFO;
+    }
+    else if (strcmp(name, "ksm") == 0)
+    {
+        file->procfs_file.type = PROC_KSM;
+    }
+    else
+    {
+        for (uint64_t i = 0; i < NR_PROCFS_KNOBS; i++)
+        {
+            if (strcmp(name, procfs_knobs[i].name) == 0)
+            {
+                file->procfs_file.type = PROC_KNOB;
+                file->procfs_file.knob = i;
+                return 0;
+            }
+        }
+        printk(RED "procfs: no such file: %s\n" CLEAR, path);
+        return -ENOENT;
+    }
+    return 0;
+}
+
+static uint64_t show_meminfo(char *buf, uint64_t size)
+{
+    uint64_t len = 0, total = 0, free = 0;
+    uint64_t nr_blocks[PROCFS_MAX_ORDER + 1];
+    memset(nr_blocks, 0, sizeof(nr_blocks));
+    buddy_free_blocks(nr_blocks, PROCFS_MAX_ORDER);
+    for (uint64_t i = 0; i < boot_info.nr_mem; i++)
+    {
+        total += boot_info.mem[i].size / PGSIZE;
+    }
+    for (uint64_t order = 0; order <= PROCFS_MAX_ORDER; order++)
+    {
+        free += nr_blocks[order] << order;
+    }
+    len += snprintf(buf + len, size - len, "MemTotal:   %ld pages\n", total);
+    len += snprintf(buf + len, size - len, "MemFree:    %ld pages\n", free);
+    len += snprintf(buf + len, size - len, "PageCache:  %ld pages\n", nr_page_cache_pages);
+    len += snprintf(buf + len, size - len, "VmaObjects: %ld pages\n", nr_vmas);
+    len += snprintf(buf + len, size - len, "SwapTotal:  %ld pages\n", swap_info.nr_slots);
+    len += snprintf(buf + len, size - len, "SwapFree:   %ld pages\n", swap_info.nr_free);
+    len += snprintf(buf + len, size - len, "FreeBlocks:");
+    for (uint64_t order = 0; order <= PROCFS_MAX_ORDER; order++)
+    {
+        len += snprintf(buf + len, size - len, " %ld", nr_blocks[order]);
+    }
+    len += snprintf(buf + len, size - len, "\n");
+    return len;
+}
+
+static uint64_t show_tasks(char *buf, uint64_t size)
+{
+    uint64_t len = snprintf(buf, size, "PID STATE PRIORITY CPU RSS FAULTS WSS\n");
+    for (int i = 0; i < NR_TASKS; i++)
+    {
+        struct task_struct *t = task[i];
+        if (!t)
+            continue;
+        len += snprintf(buf + len, size - len, "%ld %c %ld %ld %ld %ld %ld\n",
+                        t->pid, t->state == TASK_RUNNING ? 'R' : (t->state == TASK_DEAD ? 'Z' : 'S'), t->priority, t->cpu_time,
+                        (t == idle || t->state != TASK_RUNNING) ? 0 : mm_rss(t->pgd, &t->mm), t->faults.minor + t->faults.major, t->wss.idle[0]);
+    }
+    return len;
+}
+
+static uint64_t show_vmas(char *buf, uint64_t size, uint64_t pid)
+{
+    struct task_struct *t = find_task(pid);
+    uint64_t len = 0;
+    // 阻塞的 vfork 父进程的 mm 借给了子进程，已经退出的进程没有 mm
+    if (!t || t->state != TASK_RUNNING)
+        return 0;
+    for (struct vm_area_struct *vma = t->mm.mmap; vma; vma = vma->vm_next)
+    {
+        len += snprintf(buf + len, size - len, "%016lx-%016lx %c%c%c%c %lx %lx\n",
+                        vma->vm_start, vma->vm_end,
+                        (vma->vm_flags & VM_READ) ? 'r' : '-',
+                        (vma->vm_flags & VM_WRITE) ? 'w' : '-',
+                        (vma->vm_flags & VM_EXEC) ? 'x' : '-',
+                        (vma->vm_flags & VM_ANON) ? 'a' : 'f',
+                        vma->vm_pgoff, vma->vm_filesz);
+    }
+    return len;
+}
+
+static uint64_t show_wss_stat(char *buf, uint64_t size, struct wss_stat *stat)
+{
+    uint64_t len = 0;
+    for (int i = 0; i < WSS_NR_BUCKETS; i++)
+    {
+        len += snprintf(buf + len, size - len, " %ld", stat->idle[i]);
+    }
+    return len + snprintf(buf + len, size - len, " %ld\n", stat->dirty);
+}
+
+// 第一行是整个进程，之后每行一个 VMA：空闲 0、1、2-3、4-7、8+ 轮的页数，以及脏页数
+static uint64_t show_wss(char *buf, uint64_t size, uint64_t pid)
+{
+    struct task_struct *t = find_task(pid);
+    if (!t || t->state != TASK_RUNNING)
+        return 0;
+    uint64_t len = snprintf(buf, size, "scans %ld\ntotal", nr_wss_scans);
+    len += show_wss_stat(buf + len, size - len, &t->wss);
+    for (struct vm_area_struct *vma = t->mm.mmap; vma; vma = vma->vm_next)
+    {
+        len += snprintf(buf + len, size - len, "%016lx-%016lx", vma->vm_start, vma->vm_end);
+        len += show_wss_stat(buf + len, size - len, &vma->vm_wss);
+    }
+    return len;
+}
+
+/*
+ * 每一阶的空闲块数，以及该阶的不可用空闲空间比例（千分比）：
+ * 空闲页中落在比这一阶小的块里、不能满足这一阶分配的部分。
+ */
+static uint64_t show_fraginfo(char *buf, uint64_t size)
+{
+    uint64_t nr_blocks[PROCFS_MAX_ORDER + 1];
+    memset(nr_blocks, 0, sizeof(nr_blocks));
+    buddy_free_blocks(nr_blocks, PROCFS_MAX_ORDER);
+    uint64_t free = 0;
+    for (uint64_t order = 0; order <= PROCFS_MAX_ORDER; order++)
+    {
+        free += nr_blocks[order] << order;
+    }
+    uint64_t len = snprintf(buf, size, "order blocks unusable\n");
+    uint64_t smaller = 0; // 比当前阶小的块中的空闲页
+    for (uint64_t order = 0; order <= PROCFS_MAX_ORDER; order++)
+    {
+        len += snprintf(buf + len, size - len, "%ld %ld %ld\n", order, nr_blocks[order], free ? smaller * 1000 / free : 0);
+        smaller += nr_blocks[order] << order;
+    }
+    len += snprintf(buf + len, size - len, "compact_attempts %ld\ncompact_success %ld\ncompact_migrated %ld\ncompact_deferred %ld\n",
+                    compact_stat.attempts, compact_stat.success, compact_stat.migrated, compact_stat.deferred);
+    return len;
+}
+
+// 每个节点的物理地址范围、总页数、空闲页数、分配统计，以及到各节点的距离
+static uint64_t show_numainfo(char *buf, uint64_t size)
+{
+    uint64_t len = snprintf(buf, size, "local node %ld\nnode start end total free hit miss foreign distances\n", numa_node_id());
+    for (uint64_t nid = 0; nid < boot_info.nr_nodes; nid++)
+    {
+        uint64_t total = 0;
+        for (uint64_t i = 0; i < boot_info.nr_mem; i++)
+        {
+            if (boot_info.mem[i].node == nid)
+                total += boot_info.mem[i].size / PGSIZE;
+        }
+        len += snprintf(buf + len, size - len, "%ld %lx %lx %ld %ld %ld %ld %ld", nid,
+                        PFN2PHYS(buddies[nid].base), PFN2PHYS(buddies[nid].end), total, buddy_node_free_pages(nid),
+                        numa_stat[nid].hit, numa_stat[nid].miss, numa_stat[nid].foreign);
+        for (uint64_t j = 0; j < boot_info.nr_nodes; j++)
+        {
+            len += snprintf(buf + len, size - len, " %ld", boot_info.node_distance[nid][j]);
+        }
+        len += snprintf(buf + len, size - len, "\n");
+    }
+    return len;
+}
+
+// 合并页的数量和节省的页数（上一轮扫描结束时的值），以及累计的合并、拆分次数
+static uint64_t show_ksm(char *buf, uint64_t size)
+{
+    return snprintf(buf, size, "full_scans %ld\npages_shared %ld\npages_sharing %ld\nmerged %ld\nzero_merged %ld\nunmerged %ld\n",
+                    ksm_stat.full_scans, ksm_stat.pages_shared, ksm_stat.pages_sharing,
+                    ksm_stat.merged, ksm_stat.zero_merged, ksm_stat.unmerged);
+}
+
+static uint64_t show_blkstat(char *buf, uint64_t size)
+{
+    return snprintf(buf, size, "read_sectors %ld\nwrite_sectors %ld\n",
+                    virtio_blk_stat.read_sectors, virtio_blk_stat.write_sectors);
+}
+
+// 全局的缺页统计：每一类的次数和平均处理时间
+static uint64_t show_faults(char *buf, uint64_t size)
+{
+    static const char *names[NR_FAULT_TYPES] = {"zero", "file", "swap", "cow_copy", "cow_reuse"};
+    uint64_t len = snprintf(buf, size, "minor %ld\nmajor %ld\naround %ld\nhuge %ld\n",
+                            fault_stat.minor, fault_stat.major, fault_stat.around, fault_stat.huge);
+    for (int i = 0; i < NR_FAULT_TYPES; i++)
+    {
+        len += snprintf(buf + len, size - len, "%s %ld %ld\n", names[i], fault_stat.count[i],
+                        fault_stat.count[i] ? fault_stat.cycles[i] / fault_stat.count[i] : 0);
+    }
+    return len;
+}
+
+// 每次读取时重新生成整个文件的内容，返回内容长度
+static uint64_t procfs_show(struct file *file, char *buf, uint64_t size)
+{
+    uint64_t len = 0;
+    switch (file->procfs_file.type)
+    {
+    case PROC_MEMINFO:
+        len = show_meminfo(buf, size);
+        break;
+    case PROC_TASKS:
+        len = show_tasks(buf, size);
+        break;
+    case PROC_VMAS:
+        len = show_vmas(buf, size, file->procfs_file.pid);
+        break;
+    case PROC_BLKSTAT:
+        len = show_blkstat(buf, size);
+        break;
+    case PROC_FAULTS:
+        len = show_faults(buf, size);
+        break;
+    case PROC_WSS:
+        len = show_wss(buf, size, file->procfs_file.pid);
+        break;
+    case PROC_FRAGINFO:
+        len = show_fraginfo(buf, size);
+        break;
+    case PROC_NUMAINFO:
+        len = show_numainfo(buf, size);
+        break;
+    case PROC_KSM:
+        len = show_ksm(buf, size);
+        break;
+    case PROC_KNOB:
+        len = snprintf(buf, size, "%ld\n", *procfs_knobs[file->procfs_file.knob].value);
+        break;
+    }
+    return len < size ? len : size - 1;
+}
+
+int64_t procfs_read(struct file *file, void *buf, uint64_t len)
+{
+    char *content = (char *)alloc_pages(PROCFS_BUF_PAGES);
+    if (!content)
+        return -ENOMEM;
+    uint64_t size = procfs_show(file, content, PROCFS_BUF_PAGES * PGSIZE);
+    uint64_t read_len = 0;
+    if (file->cfo < size)
+    {
+        read_len = size - file->cfo < len ? size - file->cfo : len;
+        memcpy(buf, content + file->cfo, read_len);
+    }
+    put_page(content);
+    file->cfo += read_len;
+    return read_len;
+}
+
+int64_t procfs_write(struct file *file, const void *buf, uint64_t len)
+{
+    if (file->procfs_file.type != PROC_KNOB)
+        return -1;
+    struct procfs_knob *knob = &procfs_knobs[file->procfs_file.knob];
+    const char *s = (const char *)buf;
+    uint64_t value = 0, i = 0;
+    for (; i < len && s[i] >= '0' && s[i] <= '9'; i++)
+    {
+        value = value * 10 + s[i] - '0';
+    }
+    if (i == 0 || value < knob->min || value > knob->max)
+        return -1;
+    *knob->value = value;
+    if (knob->write)
+        knob->write(value);
+    return len;
+}
+
+int64_t procfs_lseek(struct file *file, int64_t offset, uint64_t whence)
+{
+    if (whence == SEEK_SET)
+    {
+        file->cfo = offset;
+    }
+    else if (whence == SEEK_CUR)
+    {
+        file->cfo = file->cfo + offset;
+    }
+    else if (whence == SEEK_END)
+    {
+        char *content = (char *)alloc_pages(PROCFS_BUF_PAGES);
+        if (!content)
+            return -ENOMEM;
+        file->cfo = procfs_show(file, content, PROCFS_BUF_PAGES * PGSIZE) + offset;
+        put_page(content);
+    }
+    else
+    {
+        printk("procfs_lseek: whence not implemented\n");
+        return -1;
+    }
+    return file->cfo;
+}
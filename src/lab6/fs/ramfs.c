@@ -0,0 +1,124 @@
+#include "ramfs.h"
+#include "pagecache.h"
+#include "proc.h"
+#include "mm.h"
+#include "string.h"
+#include "printk.h"
+
+#define ALIGN4(x) (((x) + 3) & ~3UL)
+
+static uint64_t parse_hex(const char *s)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        char c = s[i];
+        value = value * 16 + (c >= 'a' ? c - 'a' + 10 : c >= 'A' ? c - 'A' + 10 : c - '0');
+    }
+    return value;
+}
+
+int ramfs_present(void)
+{
+    return memcmp(_sramdisk, CPIO_NEWC_MAGIC, 6) == 0;
+}
+
+// 在归档中查找名为 name 的文件，没有找到时返回 -1
+static int ramfs_lookup(const char *name, struct ramfs_file *ramfs_file)
+{
+    uint64_t off = 0;
+    uint64_t len = strlen(name);
+    while (off + CPIO_NEWC_HDR_SIZE <= (uint64_t)(_eramdisk - _sramdisk))
+    {
+        const char *hdr = _sramdisk + off;
+        if (memcmp(hdr, CPIO_NEWC_MAGIC, 6) != 0)
+            return -1;
+        uint64_t filesize = parse_hex(hdr + 54);
+        uint64_t namesize = parse_hex(hdr + 94);
+        const char *entry_name = hdr + CPIO_NEWC_HDR_SIZE;
+        uint64_t data = ALIGN4(off + CPIO_NEWC_HDR_SIZE + namesize);
+        if (strcmp(entry_name, CPIO_TRAILER) == 0)
+            return -1;
+        if (namesize == len + 1 && memcmp(entry_name, name, len) == 0)
+        {
+            ramfs_file->data = _sramdisk + data;
+            ramfs_file->size = filesize;
+            ramfs_file->ino = RAMFS_INO_BASE + off;
+            return 0;
+        }
+        off = ALIGN4(data + filesize);
+    }
+    return -1;
+}
+
+int32_t ramfs_open(struct file *file, const char *path)
+{
+    // 归档是内核镜像的一部分，不允许写
+    if (!ramfs_present() || (file->perms & FILE_WRITABLE))
+        return -1;
+    return ramfs_lookup(path + 7, &file->ramfs_file); // 跳过 "/ramfs/"
+}
+
+int64_t ramfs_lseek(struct file *file, int64_t offset, uint64_t whence)
+{
+    if (whence == SEEK_SET)
+        file->cfo = offset;
+    else if (whence == SEEK_CUR)
+        file->cfo += offset;
+    else if (whence == SEEK_END)
+        file->cfo = file->ramfs_file.size + offset;
+    else
+        return -1;
+    return file->cfo;
+}
+
+int64_t ramfs_write(struct file *file, const void *buf, uint64_t len)
+{
+    return -1;
+}
+
+int64_t ramfs_read(struct file *file, void *buf, uint64_t len)
+{
+    uint64_t size = file->ramfs_file.size;
+    if (file->cfo < 0 || file->cfo >= size)
+        return 0;
+    if (file->cfo + len > size)
+        len = size - file->cfo;
+    memcpy(buf, file->ramfs_file.data + file->cfo, len);
+    file->cfo += len;
+    return len;
+}
+
+/*
+ * 数据按页对齐（mkinitramfs.sh 生成的归档保证这一点）时，完整的页直接返回归档所在的页：
+ * 它属于内核镜像，buddy_init 持有的引用不会被释放。
+ * 文件的最后一页不完整（后面是下一个文件的头部），或者数据没有对齐时，在页缓存中保存一份清零了末尾的拷贝。
+ */
+void *ramfs_get_page(struct file *file, uint64_t index)
+{
+    struct ramfs_file *ramfs_file = &file->ramfs_file;
+    uint64_t start = index * PGSIZE;
+    if (start >= ramfs_file->size)
+        return NULL;
+    const char *src = ramfs_file->data + start;
+    if ((uint64_t)src % PGSIZE == 0 && start + PGSIZE <= ramfs_file->size)
+    {
+        get_page((void *)src);
+        return (void *)src;
+    }
+    void *page = page_cache_lookup(ramfs_file->ino, index);
+    if (page)
+    {
+        get_page(page);
+        return page;
+    }
+    page = alloc_page();
+    if (!page)
+        return NULL;
+    uint64_t len = ramfs_file->size - start < PGSIZE ? ramfs_file->size - start : PGSIZE;
+    memcpy(page, src, len);
+    memset(page + len, 0, PGSIZE - len);
+    if (page_cache_insert(ramfs_file->ino, index, page) == 0)
+        get_page(page); // 一个引用属于缓存，一个返回给调用者
+    return page;
+}
@@ -3,6 +3,7 @@
 #include "sbi.h"
 #include "defs.h"
 #include "printk.h"
+#include "string.h"
 
 char uart_getchar() {
     char ret;
@@ -23,12 +24,11 @@ int64_t stdin_read(struct file *file, void *buf, uint64_t len) {
 }
 
 int64_t stdout_write(struct file *file, const void *buf, uint64_t len) {
+    // 用户缓冲区不一定以 '\0' 结尾，也可能含有 '%'，拷贝后按 %s 输出
     char to_print[len + 1];
-    for (int i = 0; i < len; i++) {
-        to_print[i] = ((const char *)buf)[i];
-    }
+    memcpy(to_print, buf, len);
     to_print[len] = 0;
-    return printk(buf);
+    return printk("%s", to_print);
 }
 
 int64_t stderr_write(struct file *file, const void *buf, uint64_t len) {
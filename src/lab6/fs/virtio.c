@@ -1,11 +1,13 @@
 #include "virtio.h"
 #include "mm.h"
+#include "fdt.h"
 
 #define virt_to_phys(va) ((uint64_t)(va) - PA2VA_OFFSET)
 
 volatile struct virtio_regs * virtio_blk_regs = NULL;
 struct vring virtio_blk_ring;
 uint64_t virtio_blk_capacity;
+struct virtio_blk_stat virtio_blk_stat;
 
 void virtio_blk_driver_init() {
     virtio_blk_regs->Status = 0;
@@ -97,6 +99,7 @@ void virtio_blk_cmd(uint32_t type, uint32_t sector, void* buf) {
 
 void virtio_blk_read_sector(uint64_t sector, void *buf) {
     Log("sector: %#x", sector);
+    virtio_blk_stat.read_sectors++;
     uint64_t original_idx = virtio_blk_ring.used->idx;
     virtio_blk_cmd(VIRTIO_BLK_T_IN, sector, buf);
     while (1) {
@@ -107,6 +110,7 @@ void virtio_blk_read_sector(uint64_t sector, void *buf) {
 }
 
 void virtio_blk_write_sector(uint64_t sector, const void *buf) {
+    virtio_blk_stat.write_sectors++;
     uint64_t original_idx = virtio_blk_ring.used->idx;
     virtio_blk_cmd(VIRTIO_BLK_T_OUT, sector, (void*)buf);
     while (1) {
@@ -154,8 +158,8 @@ int virtio_dev_test(uint64_t virtio_addr) {
 }
 
 void virtio_dev_init() {
-    for (int i = 0; i < VIRTIO_COUNT; i++) {
-        uint64_t addr = VIRTIO_START + i * VIRTIO_SIZE;
+    for (uint64_t i = 0; i < boot_info.nr_virtio; i++) {
+        uint64_t addr = boot_info.virtio[i].base;
         virtio_dev_test(io_to_virt(addr));
     }
 
@@ -17,6 +17,8 @@
 
 #define FS_TYPE_FAT32 0x1
 #define FS_TYPE_EXT2  0x2
+#define FS_TYPE_PROC  0x3
+#define FS_TYPE_RAMFS 0x4
 
 struct fat32_dir {
     uint32_t cluster;   // 文件的目录项所在的簇
@@ -26,6 +28,19 @@ struct fat32_dir {
 struct fat32_file {
     uint32_t cluster;   // 文件开头所在的簇
     struct fat32_dir dir;   // 文件的目录项信息
+    uint32_t size;      // 打开时目录项中的文件大小（写入不会扩展文件）
+};
+
+struct procfs_file {
+    uint32_t type;  // PROC_*
+    uint64_t pid;   // vmas/<pid>、wss/<pid> 对应的进程
+    uint64_t knob;  // PROC_KNOB：procfs_knobs 中的下标
+};
+
+struct ramfs_file {
+    const char *data;   // 文件内容在 initramfs 中的位置
+    uint64_t size;
+    uint64_t ino;       // 页缓存的键
 };
 
 struct file {   // Opened file in a thread.
@@ -36,11 +51,17 @@ struct file {   // Opened file in a thread.
 
     union {
         struct fat32_file fat32_file;
+        struct procfs_file procfs_file;
+        struct ramfs_file ramfs_file;
     };
 
     int64_t (*lseek) (struct file *file, int64_t offset, uint64_t whence);
     int64_t (*write) (struct file *file, const void *buf, uint64_t len);
     int64_t (*read)  (struct file *file, void *buf, uint64_t len);
+    // 返回页缓存中文件第 index 页，已经增加了引用计数；不支持 mmap 的文件系统为 NULL
+    void *(*get_page)(struct file *file, uint64_t index);
+    // 同 get_page，但不读盘：页不在内存中时返回 NULL，用于 fault-around
+    void *(*find_page)(struct file *file, uint64_t index);
 
     char path[MAX_PATH_LENGTH];
 };
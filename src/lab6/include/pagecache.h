@@ -0,0 +1,30 @@
+#ifndef __PAGECACHE_H__
+#define __PAGECACHE_H__
+
+#include "stdint.h"
+
+#define PAGE_CACHE_BUCKETS 256
+
+/*
+ * 文件页缓存：以 (ino, index) 为键，ino 由文件系统决定（FAT32 使用文件的首簇号），
+ * index 为文件内的页号。缓存本身持有每个页的一个引用，被 mmap 映射时再加上映射的引用；
+ * 只被缓存引用的页可以在内存不足时回收。缓存是写穿透的，页中的内容总是与磁盘一致。
+ */
+struct page_cache_entry
+{
+    uint64_t ino;
+    uint64_t index;
+    void *page;
+    struct page_cache_entry *next;
+};
+
+extern uint64_t nr_page_cache_pages;
+
+void page_cache_init(void);                                      // 在 buddy_init 之后调用
+void *page_cache_lookup(uint64_t ino, uint64_t index);           // 不增加引用计数
+int page_cache_insert(uint64_t ino, uint64_t index, void *page); // 缓存接管 page 的引用
+uint64_t page_cache_shrink(uint64_t nrpages);                     // 回收最多 nrpages 个页，返回回收的数量
+struct page_cache_entry *page_cache_find_page(void *page);        // 按物理页反查缓存项，O(1)
+void page_cache_migrate_page(void *old_page, void *new_page);     // 页迁移后让缓存项指向新页
+
+#endif
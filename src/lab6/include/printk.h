@@ -23,6 +23,7 @@
 #define Log(format, ...);
 #endif
 int printk(const char *, ...);
+int snprintf(char *, size_t, const char *, ...);
 
 #define Err(format, ...) {                              \
     printk("\33[1;31m[%s:%d,%s] " format "\33[0m\n",    \
@@ -0,0 +1,24 @@
+#ifndef __PROCFS_H__
+#define __PROCFS_H__
+
+#include "fs.h"
+
+#define PROCFS_BUF_PAGES 2 // 生成文件内容所用的缓冲区大小
+
+#define PROC_MEMINFO 0x1
+#define PROC_TASKS   0x2
+#define PROC_VMAS    0x3
+#define PROC_BLKSTAT 0x4
+#define PROC_KNOB    0x5 // 可写的调节参数，procfs_file.knob 为 procfs_knobs 中的下标
+#define PROC_FAULTS  0x6
+#define PROC_WSS     0x7 // 进程的工作集扫描结果，procfs_file.pid 为进程的 pid
+#define PROC_FRAGINFO 0x8
+#define PROC_NUMAINFO 0x9
+#define PROC_KSM     0xa
+
+int32_t procfs_open(struct file *file, const char *path);
+int64_t procfs_lseek(struct file *file, int64_t offset, uint64_t whence);
+int64_t procfs_write(struct file *file, const void *buf, uint64_t len);
+int64_t procfs_read(struct file *file, void *buf, uint64_t len);
+
+#endif
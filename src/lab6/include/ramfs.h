@@ -0,0 +1,28 @@
+#ifndef __RAMFS_H__
+#define __RAMFS_H__
+
+#include "fs.h"
+
+/*
+ * initramfs：链接进内核 .uapp 段的 cpio（newc 格式）归档，_sramdisk 处以 CPIO_NEWC_MAGIC 开头。
+ * ramfs 直接使用归档中的数据，不做拷贝；文件只读，通过 /ramfs/<name> 访问。
+ * 启动时 task_init 读取其中的 RAMFS_MANIFEST，按其中的列表启动用户进程。
+ */
+#define CPIO_NEWC_MAGIC "070701"
+#define CPIO_NEWC_HDR_SIZE 110
+#define CPIO_TRAILER "TRAILER!!!"
+
+#define RAMFS_MANIFEST "/ramfs/init.rc"
+
+// 页缓存中 ramfs 文件的 ino，与 FAT32 的簇号区分开
+#define RAMFS_INO_BASE (1UL << 32)
+
+int ramfs_present(void);
+
+int32_t ramfs_open(struct file *file, const char *path);
+int64_t ramfs_lseek(struct file *file, int64_t offset, uint64_t whence);
+int64_t ramfs_write(struct file *file, const void *buf, uint64_t len);
+int64_t ramfs_read(struct file *file, void *buf, uint64_t len);
+void *ramfs_get_page(struct file *file, uint64_t index);
+
+#endif
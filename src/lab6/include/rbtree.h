@@ -0,0 +1,42 @@
+#ifndef __RBTREE_H__
+#define __RBTREE_H__
+
+#include "stddef.h"
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+// 侵入式红黑树：rb_node 嵌入在元素结构体中，通过 rb_entry 取回元素
+struct rb_node {
+    struct rb_node *rb_parent;
+    struct rb_node *rb_left;
+    struct rb_node *rb_right;
+    int rb_color;
+};
+
+struct rb_root {
+    struct rb_node *rb_node;
+};
+
+#define RB_ROOT ((struct rb_root){NULL})
+
+#define rb_entry(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+// 附加信息（如子树最大值）的维护函数：根据 node 自身和左右孩子重新计算 node 的附加信息
+// 不需要附加信息时传 NULL
+typedef void (*rb_augment_f)(struct rb_node *node);
+
+// 插入分两步：调用者自己按键值下降找到位置后 rb_link_node，再 rb_insert_color 重新平衡
+void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **link);
+void rb_insert_color(struct rb_node *node, struct rb_root *root, rb_augment_f augment);
+void rb_erase(struct rb_node *node, struct rb_root *root, rb_augment_f augment);
+
+// 从 node 开始向上直到根，重新计算路径上每个结点的附加信息
+void rb_augment_path(struct rb_node *node, rb_augment_f augment);
+
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_last(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *node);
+struct rb_node *rb_prev(const struct rb_node *node);
+
+#endif
@@ -10,4 +10,8 @@ int strlen(const char *s);
 char *strcpy(char *dest, const char *src);
 int strcmp(const char *s1, const char *s2);
 
+extern int string_rvv_enabled; // 由 vector_init 在支持 V 扩展时置 1
+void *__memcpy_rvv(void *dest, const void *src, uint64_t n);
+void *__memset_rvv(void *dest, int c, uint64_t n);
+
 #endif
@@ -183,6 +183,13 @@ static inline void out32(uint32_t *memory_address, uint32_t data)
     );
 }
 
+struct virtio_blk_stat
+{
+    uint64_t read_sectors;
+    uint64_t write_sectors;
+};
+extern struct virtio_blk_stat virtio_blk_stat;
+
 int virtio_dev_test(uint64_t virtio_addr);
 void virtio_dev_init();
 void vring_init(struct vring *vr, uint32_t num, void *p, uint64_t align);
@@ -4,11 +4,16 @@
 #include "proc.h"
 
 extern void test();
+extern void string_bench();
 
 int start_kernel() {
     printk("2024");
     printk(" ZJU Operating System\n");
 
+#if BENCH_STRING
+    string_bench();
+#endif
+
     schedule();
     test();
     return 0;
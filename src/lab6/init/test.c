@@ -1,5 +1,8 @@
 #include "sbi.h"
 #include "printk.h"
+#include "string.h"
+#include "mm.h"
+#include "defs.h"
 
 void test() {
     int i = 0;
@@ -10,3 +13,177 @@ void test() {
         }
     }
 }
+
+#if BENCH_STRING
+#define BENCH_ROUNDS 256
+
+extern uint64_t get_cycles();
+
+static void *byte_memcpy(void *dest, const void *src, uint64_t n) {
+    char *d = (char *)dest;
+    const char *s = (const char *)src;
+    for (uint64_t i = 0; i < n; ++i) {
+        d[i] = s[i];
+    }
+    return dest;
+}
+
+static void *byte_memset(void *dest, int c, uint64_t n) {
+    char *s = (char *)dest;
+    for (uint64_t i = 0; i < n; ++i) {
+        s[i] = c;
+    }
+    return dest;
+}
+
+static int byte_memcmp(const void *s1, const void *s2, uint64_t n) {
+    const uint8_t *p1 = (const uint8_t *)s1;
+    const uint8_t *p2 = (const uint8_t *)s2;
+    for (uint64_t i = 0; i < n; ++i) {
+        if (p1[i] != p2[i]) {
+            return p1[i] - p2[i];
+        }
+    }
+    return 0;
+}
+
+static int sign(int x) {
+    return (x > 0) - (x < 0);
+}
+
+#define CHECK_MAX_LEN 300
+#define CHECK_BUF (CHECK_MAX_LEN + 2 * 8 + 16)
+
+// 与逐字节的实现对照：源、目的地址的偏移 0-7，长度 0-300（跨过 RVV_THRESHOLD），返回出错的次数
+static uint64_t string_check_once(uint8_t *src, uint8_t *dst, uint8_t *ref) {
+    uint64_t errors = 0;
+    for (uint64_t i = 0; i < CHECK_BUF; ++i) {
+        src[i] = i % 255 + 1; // 没有 0，覆盖其余所有字节值
+    }
+    for (uint64_t so = 0; so < 8; ++so) {
+        for (uint64_t do_ = 0; do_ < 8; ++do_) {
+            for (uint64_t n = 0; n <= CHECK_MAX_LEN; ++n) {
+                // memcpy：整个缓冲区都要和参照一致，不能写到 [dst, dst + n) 之外
+                byte_memset(dst, 0xa5, CHECK_BUF);
+                byte_memset(ref, 0xa5, CHECK_BUF);
+                memcpy(dst + do_, src + so, n);
+                byte_memcpy(ref + do_, src + so, n);
+                if (byte_memcmp(dst, ref, CHECK_BUF) != 0) {
+                    printk("string check: memcpy src+%ld dst+%ld n %ld\n", so, do_, n);
+                    errors++;
+                }
+                // memset
+                memset(dst + do_, (int)(so * 37 + 0x80), n);
+                byte_memset(ref + do_, (int)(so * 37 + 0x80), n);
+                if (byte_memcmp(dst, ref, CHECK_BUF) != 0) {
+                    printk("string check: memset dst+%ld n %ld\n", do_, n);
+                    errors++;
+                }
+                // memcmp：相等，以及在开头、中间、末尾不同时结果的符号（按无符号字节比较）
+                byte_memcpy(dst + do_, src + so, n);
+                if (memcmp(dst + do_, src + so, n) != 0) {
+                    printk("string check: memcmp equal src+%ld dst+%ld n %ld\n", so, do_, n);
+                    errors++;
+                }
+                uint64_t pos[3] = {0, n / 2, n - 1};
+                for (int k = 0; n && k < 3; ++k) {
+                    uint8_t saved = dst[do_ + pos[k]];
+                    dst[do_ + pos[k]] = saved + 0x80;
+                    if (sign(memcmp(dst + do_, src + so, n)) != sign(byte_memcmp(dst + do_, src + so, n)) ||
+                        sign(memcmp(src + so, dst + do_, n)) != sign(byte_memcmp(src + so, dst + do_, n))) {
+                        printk("string check: memcmp src+%ld dst+%ld n %ld diff at %ld\n", so, do_, n, pos[k]);
+                        errors++;
+                    }
+                    dst[do_ + pos[k]] = saved;
+                }
+            }
+        }
+        // strlen：字符串在偏移 so 处开始，按字扫描的部分跨过 0 所在的字
+        for (uint64_t n = 0; n <= CHECK_MAX_LEN; ++n) {
+            byte_memcpy(dst, src, CHECK_BUF);
+            dst[so + n] = '\0';
+            if ((uint64_t)strlen((char *)dst + so) != n) {
+                printk("string check: strlen src+%ld n %ld\n", so, n);
+                errors++;
+            }
+        }
+    }
+    return errors;
+}
+
+// 字长和 RVV 两种实现（支持 V 扩展时）分别与逐字节的实现对照
+static void string_check() {
+    uint8_t *src = (uint8_t *)alloc_page();
+    uint8_t *dst = (uint8_t *)alloc_page();
+    uint8_t *ref = (uint8_t *)alloc_page();
+    int rvv = string_rvv_enabled;
+    string_rvv_enabled = 0;
+    uint64_t errors = string_check_once(src, dst, ref);
+    string_rvv_enabled = rvv;
+    if (rvv) {
+        errors += string_check_once(src, dst, ref);
+    }
+    printk("string check: %ld errors\n", errors);
+    put_page(src);
+    put_page(dst);
+    put_page(ref);
+}
+
+// 先检查正确性，再以 time CSR 计时，输出每种实现每次调用的平均 tick 数（x100）
+void string_bench() {
+    char *src = (char *)alloc_page();
+    char *dst = (char *)alloc_page();
+    uint64_t start, t_byte, t_word, t_rvv;
+    int rvv = string_rvv_enabled;
+
+    string_check();
+
+    byte_memset(src, 'a', PGSIZE);
+    src[PGSIZE - 1] = '\0';
+    printk("string bench: size / byte / word / rvv (ticks x100 per call)\n");
+    for (uint64_t n = 8; n <= PGSIZE; n *= 2) {
+        start = get_cycles();
+        for (int i = 0; i < BENCH_ROUNDS; ++i) byte_memcpy(dst, src, n);
+        t_byte = get_cycles() - start;
+
+        string_rvv_enabled = 0;
+        start = get_cycles();
+        for (int i = 0; i < BENCH_ROUNDS; ++i) memcpy(dst, src, n);
+        t_word = get_cycles() - start;
+
+        string_rvv_enabled = rvv;
+        start = get_cycles();
+        for (int i = 0; i < BENCH_ROUNDS; ++i) if (rvv) __memcpy_rvv(dst, src, n);
+        t_rvv = get_cycles() - start;
+        printk("memcpy %4ld: %6ld %6ld %6ld\n", n, t_byte * 100 / BENCH_ROUNDS, t_word * 100 / BENCH_ROUNDS, t_rvv * 100 / BENCH_ROUNDS);
+
+        start = get_cycles();
+        for (int i = 0; i < BENCH_ROUNDS; ++i) byte_memset(dst, 0, n);
+        t_byte = get_cycles() - start;
+
+        string_rvv_enabled = 0;
+        start = get_cycles();
+        for (int i = 0; i < BENCH_ROUNDS; ++i) memset(dst, 0, n);
+        t_word = get_cycles() - start;
+
+        string_rvv_enabled = rvv;
+        start = get_cycles();
+        for (int i = 0; i < BENCH_ROUNDS; ++i) if (rvv) __memset_rvv(dst, 0, n);
+        t_rvv = get_cycles() - start;
+        printk("memset %4ld: %6ld %6ld %6ld\n", n, t_byte * 100 / BENCH_ROUNDS, t_word * 100 / BENCH_ROUNDS, t_rvv * 100 / BENCH_ROUNDS);
+
+        byte_memcpy(dst, src, n);
+        start = get_cycles();
+        for (int i = 0; i < BENCH_ROUNDS; ++i) memcmp(dst, src, n);
+        t_word = get_cycles() - start;
+        printk("memcmp %4ld:      - %6ld\n", n, t_word * 100 / BENCH_ROUNDS);
+
+        start = get_cycles();
+        for (int i = 0; i < BENCH_ROUNDS; ++i) strlen(src + PGSIZE - n);
+        t_word = get_cycles() - start;
+        printk("strlen %4ld:      - %6ld\n", n, t_word * 100 / BENCH_ROUNDS);
+    }
+    put_page(src);
+    put_page(dst);
+}
+#endif
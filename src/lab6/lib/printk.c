@@ -290,3 +290,34 @@ int printk(const char* s, ...) {
     va_end(vl);
     return res;
 }
+
+static char *sbuf;
+static size_t sbuf_len, sbuf_size;
+
+static int sputc(int c) {
+    if (sbuf_len + 1 < sbuf_size) {
+        sbuf[sbuf_len] = c;
+    }
+    sbuf_len++;
+    return (char)c;
+}
+
+// 格式化输出到 buf，最多写入 size - 1 个字符并以 '\0' 结尾，返回实际写入的长度（不含 '\0'）
+int snprintf(char *buf, size_t size, const char *s, ...) {
+    va_list vl;
+    va_start(vl, s);
+    sbuf = buf;
+    sbuf_len = 0;
+    sbuf_size = size;
+    vprintfmt(sputc, s, vl);
+    if (size == 0) {
+        va_end(vl);
+        return 0;
+    }
+    if (sbuf_len >= size) {
+        sbuf_len = size - 1;
+    }
+    buf[sbuf_len] = '\0';
+    va_end(vl);
+    return sbuf_len;
+}
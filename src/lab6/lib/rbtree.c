@@ -0,0 +1,271 @@
+#include "rbtree.h"
+
+static inline int is_black(struct rb_node *node) {
+    return !node || node->rb_color == RB_BLACK;
+}
+
+// 把 parent 中指向 old 的指针改为指向 new（parent 为 NULL 时 old 是根）
+static void change_child(struct rb_node *old, struct rb_node *new, struct rb_node *parent, struct rb_root *root) {
+    if (!parent) {
+        root->rb_node = new;
+    } else if (parent->rb_left == old) {
+        parent->rb_left = new;
+    } else {
+        parent->rb_right = new;
+    }
+}
+
+// 旋转只改变 node 和它的一个孩子所在子树的形状，子树整体的附加信息不变，
+// 因此只需要先更新下沉的 node、再更新上升的孩子
+static void rotate_left(struct rb_node *node, struct rb_root *root, rb_augment_f augment) {
+    struct rb_node *right = node->rb_right;
+    node->rb_right = right->rb_left;
+    if (right->rb_left) {
+        right->rb_left->rb_parent = node;
+    }
+    right->rb_parent = node->rb_parent;
+    change_child(node, right, node->rb_parent, root);
+    right->rb_left = node;
+    node->rb_parent = right;
+    if (augment) {
+        augment(node);
+        augment(right);
+    }
+}
+
+static void rotate_right(struct rb_node *node, struct rb_root *root, rb_augment_f augment) {
+    struct rb_node *left = node->rb_left;
+    node->rb_left = left->rb_right;
+    if (left->rb_right) {
+        left->rb_right->rb_parent = node;
+    }
+    left->rb_parent = node->rb_parent;
+    change_child(node, left, node->rb_parent, root);
+    left->rb_right = node;
+    node->rb_parent = left;
+    if (augment) {
+        augment(node);
+        augment(left);
+    }
+}
+
+void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **link) {
+    node->rb_parent = parent;
+    node->rb_left = node->rb_right = NULL;
+    node->rb_color = RB_RED;
+    *link = node;
+}
+
+void rb_augment_path(struct rb_node *node, rb_augment_f augment) {
+    if (!augment) {
+        return;
+    }
+    for (; node; node = node->rb_parent) {
+        augment(node);
+    }
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root, rb_augment_f augment) {
+    // 新结点加入后先更新到根路径上的附加信息，之后的旋转会各自维护
+    rb_augment_path(node, augment);
+
+    struct rb_node *parent, *gparent, *uncle;
+    while ((parent = node->rb_parent) && parent->rb_color == RB_RED) {
+        gparent = parent->rb_parent; // 父结点为红色，一定不是根
+        if (parent == gparent->rb_left) {
+            uncle = gparent->rb_right;
+            if (!is_black(uncle)) {
+                uncle->rb_color = RB_BLACK;
+                parent->rb_color = RB_BLACK;
+                gparent->rb_color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->rb_right) {
+                rotate_left(parent, root, augment);
+                node = parent;
+                parent = node->rb_parent;
+            }
+            parent->rb_color = RB_BLACK;
+            gparent->rb_color = RB_RED;
+            rotate_right(gparent, root, augment);
+        } else {
+            uncle = gparent->rb_left;
+            if (!is_black(uncle)) {
+                uncle->rb_color = RB_BLACK;
+                parent->rb_color = RB_BLACK;
+                gparent->rb_color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->rb_left) {
+                rotate_right(parent, root, augment);
+                node = parent;
+                parent = node->rb_parent;
+            }
+            parent->rb_color = RB_BLACK;
+            gparent->rb_color = RB_RED;
+            rotate_left(gparent, root, augment);
+        }
+    }
+    root->rb_node->rb_color = RB_BLACK;
+}
+
+// node 所在的一侧少了一个黑结点（node 可能为 NULL，所以单独传入 parent）
+static void erase_fixup(struct rb_node *node, struct rb_node *parent, struct rb_root *root, rb_augment_f augment) {
+    struct rb_node *sibling;
+    while (node != root->rb_node && is_black(node)) {
+        if (node == parent->rb_left) {
+            sibling = parent->rb_right;
+            if (!is_black(sibling)) {
+                sibling->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                rotate_left(parent, root, augment);
+                sibling = parent->rb_right;
+            }
+            if (is_black(sibling->rb_left) && is_black(sibling->rb_right)) {
+                sibling->rb_color = RB_RED;
+                node = parent;
+                parent = node->rb_parent;
+            } else {
+                if (is_black(sibling->rb_right)) {
+                    sibling->rb_left->rb_color = RB_BLACK;
+                    sibling->rb_color = RB_RED;
+                    rotate_right(sibling, root, augment);
+                    sibling = parent->rb_right;
+                }
+                sibling->rb_color = parent->rb_color;
+                parent->rb_color = RB_BLACK;
+                sibling->rb_right->rb_color = RB_BLACK;
+                rotate_left(parent, root, augment);
+                node = root->rb_node;
+                break;
+            }
+        } else {
+            sibling = parent->rb_left;
+            if (!is_black(sibling)) {
+                sibling->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                rotate_right(parent, root, augment);
+                sibling = parent->rb_left;
+            }
+            if (is_black(sibling->rb_left) && is_black(sibling->rb_right)) {
+                sibling->rb_color = RB_RED;
+                node = parent;
+                parent = node->rb_parent;
+            } else {
+                if (is_black(sibling->rb_left)) {
+                    sibling->rb_right->rb_color = RB_BLACK;
+                    sibling->rb_color = RB_RED;
+                    rotate_left(sibling, root, augment);
+                    sibling = parent->rb_left;
+                }
+                sibling->rb_color = parent->rb_color;
+                parent->rb_color = RB_BLACK;
+                sibling->rb_left->rb_color = RB_BLACK;
+                rotate_right(parent, root, augment);
+                node = root->rb_node;
+                break;
+            }
+        }
+    }
+    if (node) {
+        node->rb_color = RB_BLACK;
+    }
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root, rb_augment_f augment) {
+    struct rb_node *child, *parent;
+    int color;
+    if (!node->rb_left || !node->rb_right) {
+        // 至多一个孩子：孩子直接顶替 node
+        child = node->rb_left ? node->rb_left : node->rb_right;
+        parent = node->rb_parent;
+        color = node->rb_color;
+        if (child) {
+            child->rb_parent = parent;
+        }
+        change_child(node, child, parent, root);
+    } else {
+        // 两个孩子：用右子树中最小的后继 succ 顶替 node，succ 原来的位置由它的右孩子顶替
+        struct rb_node *succ = node->rb_right;
+        while (succ->rb_left) {
+            succ = succ->rb_left;
+        }
+        child = succ->rb_right;
+        color = succ->rb_color;
+        if (succ->rb_parent == node) {
+            parent = succ;
+        } else {
+            parent = succ->rb_parent;
+            parent->rb_left = child;
+            if (child) {
+                child->rb_parent = parent;
+            }
+            succ->rb_right = node->rb_right;
+            node->rb_right->rb_parent = succ;
+        }
+        succ->rb_left = node->rb_left;
+        node->rb_left->rb_parent = succ;
+        succ->rb_parent = node->rb_parent;
+        succ->rb_color = node->rb_color;
+        change_child(node, succ, node->rb_parent, root);
+    }
+    // parent 是结构发生变化的最低结点（succ 顶替 node 时它也在这条路径上）
+    rb_augment_path(parent, augment);
+    if (color == RB_BLACK) {
+        erase_fixup(child, parent, root, augment);
+    }
+}
+
+struct rb_node *rb_first(const struct rb_root *root) {
+    struct rb_node *node = root->rb_node;
+    if (!node) {
+        return NULL;
+    }
+    while (node->rb_left) {
+        node = node->rb_left;
+    }
+    return node;
+}
+
+struct rb_node *rb_last(const struct rb_root *root) {
+    struct rb_node *node = root->rb_node;
+    if (!node) {
+        return NULL;
+    }
+    while (node->rb_right) {
+        node = node->rb_right;
+    }
+    return node;
+}
+
+struct rb_node *rb_next(const struct rb_node *node) {
+    if (node->rb_right) {
+        node = node->rb_right;
+        while (node->rb_left) {
+            node = node->rb_left;
+        }
+        return (struct rb_node *)node;
+    }
+    struct rb_node *parent;
+    while ((parent = node->rb_parent) && node == parent->rb_right) {
+        node = parent;
+    }
+    return parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node) {
+    if (node->rb_left) {
+        node = node->rb_left;
+        while (node->rb_right) {
+            node = node->rb_right;
+        }
+        return (struct rb_node *)node;
+    }
+    struct rb_node *parent;
+    while ((parent = node->rb_parent) && node == parent->rb_left) {
+        node = parent;
+    }
+    return parent;
+}
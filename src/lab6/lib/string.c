@@ -2,40 +2,122 @@
 #include "stdint.h"
 #include "printk.h"
 
+#define WORD_SIZE sizeof(uint64_t)
+#define WORD_MASK (WORD_SIZE - 1)
+#define ONES 0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+#define HAS_ZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+
+// 长度不小于 RVV_THRESHOLD 时使用 RVV 实现（需要保存 / 恢复 v0-v7，短拷贝不划算）
+#define RVV_THRESHOLD 256
+
+int string_rvv_enabled;
+
 void *memset(void *dest, int c, uint64_t n) {
-    char *s = (char *)dest;
-    for (uint64_t i = 0; i < n; ++i) {
-        s[i] = c;
+    if (string_rvv_enabled && n >= RVV_THRESHOLD) {
+        return __memset_rvv(dest, c, n);
+    }
+    uint8_t *d = (uint8_t *)dest;
+    // 头部：按字节写到 8 字节对齐
+    while (n && ((uint64_t)d & WORD_MASK)) {
+        *d++ = c;
+        --n;
+    }
+    uint64_t pattern = (uint8_t)c * ONES;
+    uint64_t *w = (uint64_t *)d;
+    for (; n >= 4 * WORD_SIZE; n -= 4 * WORD_SIZE, w += 4) {
+        w[0] = pattern;
+        w[1] = pattern;
+        w[2] = pattern;
+        w[3] = pattern;
+    }
+    for (; n >= WORD_SIZE; n -= WORD_SIZE) {
+        *w++ = pattern;
+    }
+    // 尾部
+    d = (uint8_t *)w;
+    while (n--) {
+        *d++ = c;
     }
     return dest;
 }
 
 void *memcpy(void *dest, const void *src, uint64_t n) {
-    char *d = (char *)dest;
-    const char *s = (const char *)src;
-    for (uint64_t i = 0; i < n; ++i) {
-        d[i] = s[i];
+    if (string_rvv_enabled && n >= RVV_THRESHOLD) {
+        return __memcpy_rvv(dest, src, n);
+    }
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *s = (const uint8_t *)src;
+    // 只有源和目的地址模 8 同余时才能按字拷贝，否则逐字节拷贝
+    if ((((uint64_t)d ^ (uint64_t)s) & WORD_MASK) == 0) {
+        while (n && ((uint64_t)d & WORD_MASK)) {
+            *d++ = *s++;
+            --n;
+        }
+        uint64_t *wd = (uint64_t *)d;
+        const uint64_t *ws = (const uint64_t *)s;
+        for (; n >= 4 * WORD_SIZE; n -= 4 * WORD_SIZE, wd += 4, ws += 4) {
+            uint64_t a = ws[0], b = ws[1], c = ws[2], e = ws[3];
+            wd[0] = a;
+            wd[1] = b;
+            wd[2] = c;
+            wd[3] = e;
+        }
+        for (; n >= WORD_SIZE; n -= WORD_SIZE) {
+            *wd++ = *ws++;
+        }
+        d = (uint8_t *)wd;
+        s = (const uint8_t *)ws;
+    }
+    while (n--) {
+        *d++ = *s++;
     }
     return dest;
 }
 
 int memcmp(const void *s1, const void *s2, uint64_t n) {
-    const char *p1 = (const char *)s1;
-    const char *p2 = (const char *)s2;
-    for (uint64_t i = 0; i < n; ++i) {
-        if (p1[i] != p2[i]) {
-            return p1[i] - p2[i];
+    const uint8_t *p1 = (const uint8_t *)s1;
+    const uint8_t *p2 = (const uint8_t *)s2;
+    if ((((uint64_t)p1 ^ (uint64_t)p2) & WORD_MASK) == 0) {
+        while (n && ((uint64_t)p1 & WORD_MASK)) {
+            if (*p1 != *p2) {
+                return *p1 - *p2;
+            }
+            ++p1, ++p2, --n;
+        }
+        // 按字比较，找到第一个不同的字后交给下面的逐字节比较
+        for (; n >= WORD_SIZE; n -= WORD_SIZE, p1 += WORD_SIZE, p2 += WORD_SIZE) {
+            if (*(const uint64_t *)p1 != *(const uint64_t *)p2) {
+                break;
+            }
+        }
+    }
+    for (; n; ++p1, ++p2, --n) {
+        if (*p1 != *p2) {
+            return *p1 - *p2;
         }
     }
     return 0;
 }
 
 int strlen(const char *s) {
-    int len = 0;
-    while (s[len]) {
-        ++len;
+    const char *p = s;
+    while ((uint64_t)p & WORD_MASK) {
+        if (!*p) {
+            return p - s;
+        }
+        ++p;
+    }
+    // 对齐的 8 字节读取不会跨页，读到字符串结尾之后的字节是安全的
+    const uint64_t *w = (const uint64_t *)p;
+    while (!HAS_ZERO(*w)) {
+        ++w;
+    }
+    p = (const char *)w;
+    while (*p) {
+        ++p;
     }
-    return len;
+    return p - s;
 }
 
 char *strcpy(char *dest, const char *src) {
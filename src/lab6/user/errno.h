@@ -0,0 +1,12 @@
+#ifndef __ERRNO_H__
+#define __ERRNO_H__
+
+// 与 Linux 相同的错误码，系统调用失败时返回其相反数
+#define ENOENT 2
+#define EBADF 9
+#define ENOMEM 12
+#define EACCES 13
+#define ENODEV 19
+#define EINVAL 22
+
+#endif
@@ -81,6 +81,11 @@ void parse_cmd(char *cmd, int len) {
             }
         }
         close(fd);
+    } else if (cmd[0] == 'r' && cmd[1] == 'u' && cmd[2] == 'n') {
+        char *path = get_param(cmd + 3);
+        if (spawn(path) < 0) {
+            printf("can't run: %s\n", path);
+        }
     } else if (cmd[0] == 'e' && cmd[1] == 'd' && cmd[2] == 'i' && cmd[3] == 't' ) {
         cmd += 4;
         while (*cmd == ' ' && *cmd != '\0') {
@@ -0,0 +1,54 @@
+#!/bin/sh
+# 用法：mkinitramfs.sh <输出文件> <文件>...
+# 生成 cpio（newc 格式）归档。每个文件之前插入一个名为 .pad 的填充项，使文件内容在归档中按页对齐，
+# 这样内核的 ramfs 可以直接把归档中的页映射给用户进程。
+set -e
+
+PAGE=4096
+out=$1
+shift
+: > "$out"
+off=0
+
+align4() {
+    echo $(( ($1 + 3) / 4 * 4 ))
+}
+
+# 写入一个头部和文件名，参数：ino mode filesize name
+header() {
+    namesize=$(( ${#4} + 1 ))
+    printf '070701%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X' \
+        "$1" "$2" 0 0 1 0 "$3" 0 0 0 0 "$namesize" 0 >> "$out"
+    printf '%s\0' "$4" >> "$out"
+    end=$(( off + 110 + namesize ))
+    pad $(( $(align4 $end) - end ))
+    off=$(align4 $end)
+}
+
+pad() {
+    if [ "$1" -gt 0 ]; then
+        head -c "$1" /dev/zero >> "$out"
+    fi
+}
+
+ino=1
+for file in "$@"; do
+    name=$(basename "$file")
+    size=$(wc -c < "$file")
+    # 填充项自身的头部之后是填充数据，随后是真正的头部
+    pad_data=$(align4 $(( off + 110 + 5 )))
+    name_end=$(( $(align4 $(( 110 + ${#name} + 1 ))) ))
+    fill=$(( (PAGE - (pad_data + name_end) % PAGE) % PAGE ))
+    header $ino 33188 $fill .pad
+    pad $fill
+    off=$(( off + fill ))
+    ino=$(( ino + 1 ))
+
+    header $ino 33188 $size "$name"
+    cat "$file" >> "$out"
+    off=$(( off + size ))
+    pad $(( $(align4 $off) - off ))
+    off=$(align4 $off)
+    ino=$(( ino + 1 ))
+done
+header 0 0 0 TRAILER!!!
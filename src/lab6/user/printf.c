@@ -1,6 +1,6 @@
 // credit: 45gfg9 <45gfg9@45gfg9.net>
 #include "stdio.h"
-#include "syscall.h"
+#include "unistd.h"
 
 int tail = 0;
 char buffer[1000] = {[0 ... 999] = 0};
@@ -289,16 +289,7 @@ int printf(const char* s, ...) {
     va_list vl;
     va_start(vl, s);
     res = vprintfmt(putc, s, vl);
-    long syscall_ret, fd = 1;
-    buffer[tail++] = '\0';
-    asm volatile ("li a7, %1\n"
-                  "mv a0, %2\n"
-                  "mv a1, %3\n"
-                  "mv a2, %4\n"
-                  "ecall\n"
-                  "mv %0, a0\n"
-                  : "+r" (syscall_ret)
-                  : "i" (SYS_WRITE), "r" (fd), "r" (&buffer), "r" (tail));
+    write(1, buffer, tail);
     tail = 0;
     va_end(vl);
     return res;
@@ -1,9 +1,191 @@
 #include "string.h"
 #include "stdint.h"
+#include "unistd.h"
+
+#define WORD_SIZE sizeof(uint64_t)
+#define WORD_MASK (WORD_SIZE - 1)
+#define ONES 0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+#define HAS_ZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+
+// 用户态的向量寄存器都是 caller-saved，不需要像内核那样保存，阈值可以低一些
+#define RVV_THRESHOLD 64
+
+static int use_rvv;
+
+void __init_string(void) {
+    struct riscv_hwprobe pair = {.key = RISCV_HWPROBE_KEY_IMA_EXT_0};
+    if (riscv_hwprobe(&pair, 1) == 0 && pair.key == RISCV_HWPROBE_KEY_IMA_EXT_0) {
+        use_rvv = (pair.value & RISCV_HWPROBE_IMA_V) != 0;
+    }
+}
+
+// 从低地址向高地址拷贝；dest <= src 时即使重叠也是安全的（memmove 复用）
+static void *copy_forward(void *dest, const void *src, uint64_t n) {
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *s = (const uint8_t *)src;
+    // 只有源和目的地址模 8 同余时才能按字拷贝
+    if ((((uint64_t)d ^ (uint64_t)s) & WORD_MASK) == 0) {
+        while (n && ((uint64_t)d & WORD_MASK)) {
+            *d++ = *s++;
+            --n;
+        }
+        uint64_t *wd = (uint64_t *)d;
+        const uint64_t *ws = (const uint64_t *)s;
+        for (; n >= 4 * WORD_SIZE; n -= 4 * WORD_SIZE, wd += 4, ws += 4) {
+            uint64_t a = ws[0], b = ws[1], c = ws[2], e = ws[3];
+            wd[0] = a;
+            wd[1] = b;
+            wd[2] = c;
+            wd[3] = e;
+        }
+        for (; n >= WORD_SIZE; n -= WORD_SIZE) {
+            *wd++ = *ws++;
+        }
+        d = (uint8_t *)wd;
+        s = (const uint8_t *)ws;
+    }
+    while (n--) {
+        *d++ = *s++;
+    }
+    return dest;
+}
+
+// 从高地址向低地址拷贝，用于 dest > src 的重叠情况
+static void *copy_backward(void *dest, const void *src, uint64_t n) {
+    uint8_t *d = (uint8_t *)dest + n;
+    const uint8_t *s = (const uint8_t *)src + n;
+    if ((((uint64_t)d ^ (uint64_t)s) & WORD_MASK) == 0) {
+        while (n && ((uint64_t)d & WORD_MASK)) {
+            *--d = *--s;
+            --n;
+        }
+        uint64_t *wd = (uint64_t *)d;
+        const uint64_t *ws = (const uint64_t *)s;
+        for (; n >= WORD_SIZE; n -= WORD_SIZE) {
+            *--wd = *--ws;
+        }
+        d = (uint8_t *)wd;
+        s = (const uint8_t *)ws;
+    }
+    while (n--) {
+        *--d = *--s;
+    }
+    return dest;
+}
+
+void *memcpy(void *dest, const void *src, uint64_t n) {
+    if (use_rvv && n >= RVV_THRESHOLD) {
+        return __memcpy_rvv(dest, src, n);
+    }
+    return copy_forward(dest, src, n);
+}
+
+void *memmove(void *dest, const void *src, uint64_t n) {
+    if ((uint64_t)dest <= (uint64_t)src || (uint64_t)dest >= (uint64_t)src + n) {
+        // 向量版本每轮先整段读入再写出，dest <= src 的重叠同样安全
+        return memcpy(dest, src, n);
+    }
+    return copy_backward(dest, src, n);
+}
+
+void *memset(void *dest, int c, uint64_t n) {
+    if (use_rvv && n >= RVV_THRESHOLD) {
+        return __memset_rvv(dest, c, n);
+    }
+    uint8_t *d = (uint8_t *)dest;
+    while (n && ((uint64_t)d & WORD_MASK)) {
+        *d++ = c;
+        --n;
+    }
+    uint64_t pattern = (uint8_t)c * ONES;
+    uint64_t *w = (uint64_t *)d;
+    for (; n >= 4 * WORD_SIZE; n -= 4 * WORD_SIZE, w += 4) {
+        w[0] = pattern;
+        w[1] = pattern;
+        w[2] = pattern;
+        w[3] = pattern;
+    }
+    for (; n >= WORD_SIZE; n -= WORD_SIZE) {
+        *w++ = pattern;
+    }
+    d = (uint8_t *)w;
+    while (n--) {
+        *d++ = c;
+    }
+    return dest;
+}
+
+int memcmp(const void *s1, const void *s2, uint64_t n) {
+    const uint8_t *p1 = (const uint8_t *)s1;
+    const uint8_t *p2 = (const uint8_t *)s2;
+    if ((((uint64_t)p1 ^ (uint64_t)p2) & WORD_MASK) == 0) {
+        while (n && ((uint64_t)p1 & WORD_MASK)) {
+            if (*p1 != *p2) {
+                return *p1 - *p2;
+            }
+            ++p1, ++p2, --n;
+        }
+        // 找到第一个不同的字后交给下面的逐字节比较
+        for (; n >= WORD_SIZE; n -= WORD_SIZE, p1 += WORD_SIZE, p2 += WORD_SIZE) {
+            if (*(const uint64_t *)p1 != *(const uint64_t *)p2) {
+                break;
+            }
+        }
+    }
+    for (; n; ++p1, ++p2, --n) {
+        if (*p1 != *p2) {
+            return *p1 - *p2;
+        }
+    }
+    return 0;
+}
 
 int strlen(const char *str) {
-    int len = 0;
-    while (*str++)
-        len++;
-    return len;
-}
\ No newline at end of file
+    if (use_rvv) {
+        // vle8ff.v 在越过页边界出错时只截短 vl，不会读到未映射的页
+        return __strlen_rvv(str);
+    }
+    const char *p = str;
+    while ((uint64_t)p & WORD_MASK) {
+        if (!*p) {
+            return p - str;
+        }
+        ++p;
+    }
+    // 对齐的 8 字节读取不会跨页
+    const uint64_t *w = (const uint64_t *)p;
+    while (!HAS_ZERO(*w)) {
+        ++w;
+    }
+    p = (const char *)w;
+    while (*p) {
+        ++p;
+    }
+    return p - str;
+}
+
+int strcmp(const char *s1, const char *s2) {
+    const uint8_t *p1 = (const uint8_t *)s1;
+    const uint8_t *p2 = (const uint8_t *)s2;
+    if ((((uint64_t)p1 ^ (uint64_t)p2) & WORD_MASK) == 0) {
+        while ((uint64_t)p1 & WORD_MASK) {
+            if (*p1 != *p2 || !*p1) {
+                return *p1 - *p2;
+            }
+            ++p1, ++p2;
+        }
+        // 两个字相同且不含 '\0' 时整字跳过，否则交给下面的逐字节比较
+        const uint64_t *w1 = (const uint64_t *)p1;
+        const uint64_t *w2 = (const uint64_t *)p2;
+        while (*w1 == *w2 && !HAS_ZERO(*w1)) {
+            ++w1, ++w2;
+        }
+        p1 = (const uint8_t *)w1;
+        p2 = (const uint8_t *)w2;
+    }
+    while (*p1 && *p1 == *p2) {
+        ++p1, ++p2;
+    }
+    return *p1 - *p2;
+}
@@ -1,6 +1,20 @@
 #ifndef __STRING_H__
 #define __STRING_H__
 
+#include "stdint.h"
+
+void *memcpy(void *dest, const void *src, uint64_t n);
+void *memmove(void *dest, const void *src, uint64_t n);
+void *memset(void *dest, int c, uint64_t n);
+int memcmp(const void *s1, const void *s2, uint64_t n);
 int strlen(const char *str);
+int strcmp(const char *s1, const char *s2);
+
+// 由 start.S 在进入 main 之前调用，根据内核报告的 hwcap 选择实现
+void __init_string(void);
+
+void *__memcpy_rvv(void *dest, const void *src, uint64_t n);
+void *__memset_rvv(void *dest, int c, uint64_t n);
+uint64_t __strlen_rvv(const char *str);
 
-#endif
\ No newline at end of file
+#endif
@@ -6,7 +6,15 @@
 #define SYS_LSEEK   62
 #define SYS_READ    63
 #define SYS_WRITE   64
+#define SYS_EXIT    93
 #define SYS_GETPID  172
+#define SYS_MUNMAP  215
 #define SYS_CLONE   220
+#define SYS_EXECVE  221
+#define SYS_MMAP    222
+#define SYS_MPROTECT 226
+#define SYS_RISCV_HWPROBE 258
+#define SYS_SPAWN   400
+#define SYS_FAULTSTAT 401
 
-#endif
\ No newline at end of file
+#endif
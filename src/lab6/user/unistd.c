@@ -1,49 +1,45 @@
 #include "unistd.h"
 #include "syscall.h"
 
+// 参数直接绑定到 a0-a2 / a7，避免 -O2 下编译器把操作数分配到被 mv 覆盖的寄存器里
+static long syscall3(long n, long arg0, long arg1, long arg2) {
+    register long a0 asm("a0") = arg0;
+    register long a1 asm("a1") = arg1;
+    register long a2 asm("a2") = arg2;
+    register long a7 asm("a7") = n;
+    asm volatile ("ecall"
+                  : "+r" (a0)
+                  : "r" (a1), "r" (a2), "r" (a7)
+                  : "memory");
+    return a0;
+}
+
+static long syscall6(long n, long arg0, long arg1, long arg2, long arg3, long arg4, long arg5) {
+    register long a0 asm("a0") = arg0;
+    register long a1 asm("a1") = arg1;
+    register long a2 asm("a2") = arg2;
+    register long a3 asm("a3") = arg3;
+    register long a4 asm("a4") = arg4;
+    register long a5 asm("a5") = arg5;
+    register long a7 asm("a7") = n;
+    asm volatile ("ecall"
+                  : "+r" (a0)
+                  : "r" (a1), "r" (a2), "r" (a3), "r" (a4), "r" (a5), "r" (a7)
+                  : "memory");
+    return a0;
+}
+
+// 内核按 count 截取输出，不再需要在用户态拷贝一份以 '\0' 结尾的缓冲区
 int write(int fd, const void *buf, uint64_t count) {
-    char temp_buf[count + 1];
-    for (int i = 0; i < count; i++) {
-        temp_buf[i] = ((char*)buf)[i];
-    }
-    temp_buf[count] = 0;
-
-    long syscall_ret;
-    asm volatile ("li a7, %1\n"
-                  "mv a0, %2\n"
-                  "mv a1, %3\n"
-                  "mv a2, %4\n"
-                  "ecall\n"
-                  "mv %0, a0\n"
-                  : "+r" (syscall_ret)
-                  : "i" (SYS_WRITE), "r" ((int64_t)fd), "r" (&temp_buf), "r" (count));
-    return syscall_ret;
+    return syscall3(SYS_WRITE, fd, (long)buf, count);
 }
 
 int read(int fd, void *buf, uint64_t count) {
-    long syscall_ret;
-    asm volatile ("li a7, %1\n"
-                  "mv a0, %2\n"
-                  "mv a1, %3\n"
-                  "mv a2, %4\n"
-                  "ecall\n"
-                  "mv %0, a0\n"
-                  : "+r" (syscall_ret)
-                  : "i" (SYS_READ), "r" ((int64_t)fd), "r" (buf), "r" (count));
-    return syscall_ret;   
+    return syscall3(SYS_READ, fd, (long)buf, count);
 }
 
 int sys_openat(int dfd, char *filename, int flags) {
-    long syscall_ret;
-    asm volatile ("li a7, %1\n"
-                  "mv a0, %2\n"
-                  "mv a1, %3\n"
-                  "mv a2, %4\n"
-                  "ecall\n"
-                  "mv %0, a0\n"
-                  : "+r" (syscall_ret)
-                  : "i" (SYS_OPENAT), "r" ((int64_t)dfd), "r" (filename), "r" ((int64_t)flags));
-    return syscall_ret;   
+    return syscall3(SYS_OPENAT, dfd, (long)filename, flags);
 }
 
 int open(char *filename, int flags) {
@@ -51,25 +47,50 @@ int open(char *filename, int flags) {
 }
 
 int close(int fd) {
-    long syscall_ret;
-    asm volatile ("li a7, %1\n"
-                  "mv a0, %2\n"
-                  "ecall\n"
-                  "mv %0, a0\n"
-                  : "+r" (syscall_ret)
-                  : "i" (SYS_CLOSE), "r" ((int64_t)fd));
-    return syscall_ret;
+    return syscall3(SYS_CLOSE, fd, 0, 0);
 }
 
 int lseek(int fd, int offset, int whence) {
-    long syscall_ret;
-    asm volatile ("li a7, %1\n"
-                  "mv a0, %2\n"
-                  "mv a1, %3\n"
-                  "mv a2, %4\n"
-                  "ecall\n"
-                  "mv %0, a0\n"
-                  : "+r" (syscall_ret)
-                  : "i" (SYS_LSEEK), "r" ((int64_t)fd), "r" ((int64_t)offset), "r" ((int64_t)whence));
-    return syscall_ret;
-}
\ No newline at end of file
+    return syscall3(SYS_LSEEK, fd, offset, whence);
+}
+
+// 内核返回 -errno 表示失败，和 libc 一样统一为 MAP_FAILED
+void *mmap(void *addr, uint64_t length, int prot, int flags, int fd, uint64_t offset) {
+    long ret = syscall6(SYS_MMAP, (long)addr, length, prot, flags, fd, offset);
+    return (ret < 0 && ret >= -4095) ? MAP_FAILED : (void *)ret;
+}
+
+int munmap(void *addr, uint64_t length) {
+    return syscall3(SYS_MUNMAP, (long)addr, length, 0);
+}
+
+int mprotect(void *addr, uint64_t length, int prot) {
+    return syscall3(SYS_MPROTECT, (long)addr, length, prot);
+}
+
+int riscv_hwprobe(struct riscv_hwprobe *pairs, uint64_t pair_count) {
+    return syscall6(SYS_RISCV_HWPROBE, (long)pairs, pair_count, 0, 0, 0, 0);
+}
+
+// 成功时不返回
+int execve(const char *path, char *const argv[], char *const envp[]) {
+    return syscall3(SYS_EXECVE, (long)path, (long)argv, (long)envp);
+}
+
+void exit(int status) {
+    syscall3(SYS_EXIT, status, 0, 0);
+    while (1)
+        ;
+}
+
+int fork(void) {
+    return syscall3(SYS_CLONE, 0, 0, 0);
+}
+
+int spawn(const char *path) {
+    return syscall3(SYS_SPAWN, (long)path, 0, 0);
+}
+
+int faultstat(int pid, struct fault_stat *stat, struct fault_record *trace, uint64_t n) {
+    return syscall6(SYS_FAULTSTAT, pid, (long)stat, (long)trace, n, 0, 0);
+}
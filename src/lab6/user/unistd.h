@@ -13,10 +13,67 @@
 #define SEEK_CUR    0x0001
 #define SEEK_END    0x0002
 
+#define PROT_NONE  0x0
+#define PROT_READ  0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC  0x4
+
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_FIXED     0x10
+#define MAP_ANONYMOUS 0x20
+#define MAP_FAILED    ((void *)-1)
+
+// riscv_hwprobe 的 key / value，与 Linux 的 <asm/hwprobe.h> 一致
+#define RISCV_HWPROBE_KEY_BASE_BEHAVIOR 3
+#define RISCV_HWPROBE_BASE_BEHAVIOR_IMA (1 << 0)
+#define RISCV_HWPROBE_KEY_IMA_EXT_0     4
+#define RISCV_HWPROBE_IMA_FD            (1 << 0)
+#define RISCV_HWPROBE_IMA_C             (1 << 1)
+#define RISCV_HWPROBE_IMA_V             (1 << 2)
+
+struct riscv_hwprobe {
+    int64_t key;
+    uint64_t value;
+};
+
+// 缺页统计，与内核的 vm.h 一致
+#define FAULT_ZERO      0
+#define FAULT_FILE      1
+#define FAULT_SWAP      2
+#define FAULT_COW_COPY  3
+#define FAULT_COW_REUSE 4
+#define NR_FAULT_TYPES  5
+
+struct fault_stat {
+    uint64_t minor, major;
+    uint64_t count[NR_FAULT_TYPES];
+    uint64_t cycles[NR_FAULT_TYPES];
+    uint64_t around;
+    uint64_t huge;
+};
+
+struct fault_record {
+    uint64_t pid, pc, va;
+    uint64_t type, major, cycles;
+};
+
 int open(char *filename, int flags);
 int write(int fd, const void *buf, uint64_t count);
 int read(int fd, void *buf, uint64_t count);
 int close(int fd);
 int lseek(int fd, int offset, int whence);
+// mmap 失败时返回 MAP_FAILED；munmap / mprotect 失败时返回 -errno（EINVAL、ENOMEM、EACCES）
+void *mmap(void *addr, uint64_t length, int prot, int flags, int fd, uint64_t offset);
+int munmap(void *addr, uint64_t length);
+int mprotect(void *addr, uint64_t length, int prot);
+int riscv_hwprobe(struct riscv_hwprobe *pairs, uint64_t pair_count);
+int execve(const char *path, char *const argv[], char *const envp[]);
+void exit(int status);
+int fork(void); // 子进程得到写时复制的地址空间，返回 0
+int vfork(void); // 见 vfork.S。子进程只能调用 execve 或 exit
+int spawn(const char *path); // 新进程运行 path，继承打开的文件，返回 pid
+// pid 为 0 取当前进程、-1 取全局的缺页统计；trace 不为 NULL 时拷贝最多 n 条最近的缺页记录（需要打开 /proc/fault_trace），返回条数
+int faultstat(int pid, struct fault_stat *stat, struct fault_record *trace, uint64_t n);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,150 @@
+// mmap / munmap / mprotect 与 fork 写时复制的自测，由 init.rc 启动，逐项输出 PASS / FAIL
+#include "stdio.h"
+#include "unistd.h"
+#include "string.h"
+#include "errno.h"
+
+#define PGSIZE 4096
+#define NPAGES 8
+#define COW_PAGES 64    // 不到 2 MiB，不会用大页；跨过一整张末级页表中的多项
+#define DONE_PAGES 8    // 子进程结束检查后触碰的新页数，父进程据此等待
+#define WAIT_POLLS 100000
+
+int failed;
+
+static void check(int ok, const char *what) {
+    printf("vmtest: %s %s\n", ok ? GREEN "PASS" CLEAR : RED "FAIL" CLEAR, what);
+    if (!ok) {
+        failed++;
+    }
+}
+
+static uint64_t *page(char *base, int i) {
+    return (uint64_t *)(base + i * PGSIZE);
+}
+
+// 每页第一个字写入标记
+static void fill(char *base, int from, int to, uint64_t tag) {
+    for (int i = from; i < to; i++) {
+        *page(base, i) = tag + i;
+    }
+}
+
+static int tagged(char *base, int from, int to, uint64_t tag) {
+    for (int i = from; i < to; i++) {
+        if (*page(base, i) != tag + i) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void test_split(void) {
+    char *p = mmap(NULL, NPAGES * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    check(p != MAP_FAILED, "mmap anonymous");
+    if (p == MAP_FAILED) {
+        return;
+    }
+    fill(p, 0, NPAGES, 100);
+
+    // 中间两页改为只读，VMA 拆成三段；两侧仍然可写（写入只读页会终止进程，看不到后面的输出）
+    check(mprotect(p + 2 * PGSIZE, 2 * PGSIZE, PROT_READ) == 0, "mprotect middle read-only");
+    fill(p, 0, 2, 200);
+    fill(p, 4, NPAGES, 200);
+    check(tagged(p, 0, 2, 200) && tagged(p, 2, 4, 100) && tagged(p, 4, NPAGES, 200), "mprotect split keeps data");
+    check(mprotect(p, NPAGES * PGSIZE, PROT_READ | PROT_WRITE) == 0, "mprotect whole range back");
+    fill(p, 2, 4, 200);
+    check(tagged(p, 0, NPAGES, 200), "write after merge");
+
+    // 挖掉第 5 页
+    check(munmap(p + 5 * PGSIZE, PGSIZE) == 0, "munmap middle page");
+    check(tagged(p, 0, 5, 200) && tagged(p, 6, NPAGES, 200), "munmap split keeps data");
+    check(mprotect(p + 4 * PGSIZE, 3 * PGSIZE, PROT_READ) == -ENOMEM, "mprotect over a hole is -ENOMEM");
+    check(munmap(p + 1, PGSIZE) == -EINVAL, "munmap unaligned is -EINVAL");
+
+    // MAP_FIXED 填上空洞，并覆盖已有的第 1、2 页
+    char *q = mmap(p + 5 * PGSIZE, PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    check(q == p + 5 * PGSIZE && *page(p, 5) == 0, "MAP_FIXED into a hole");
+    q = mmap(p + PGSIZE, 2 * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    check(q == p + PGSIZE && *page(p, 1) == 0 && *page(p, 2) == 0, "MAP_FIXED replaces old pages");
+    check(tagged(p, 0, 1, 200) && tagged(p, 3, 5, 200) && tagged(p, 6, NPAGES, 200), "MAP_FIXED keeps neighbours");
+    check(mmap(p + 1, PGSIZE, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED, "MAP_FIXED unaligned fails");
+
+    check(munmap(p, NPAGES * PGSIZE) == 0, "munmap whole range");
+}
+
+static void test_eacces(void) {
+    int fd = open("/ramfs/init.rc", O_RDONLY);
+    check(fd >= 0, "open /ramfs/init.rc");
+    if (fd < 0) {
+        return;
+    }
+    char buf[16];
+    int n = read(fd, buf, sizeof(buf));
+    check(mmap(NULL, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) == MAP_FAILED, "writable shared mapping of read-only file fails");
+    char *p = mmap(NULL, PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+    check(p != MAP_FAILED && n > 0 && memcmp(p, buf, n) == 0, "read-only shared mapping matches read");
+    if (p != MAP_FAILED) {
+        check(mprotect(p, PGSIZE, PROT_READ | PROT_WRITE) == -EACCES, "mprotect(PROT_WRITE) is -EACCES");
+        munmap(p, PGSIZE);
+    }
+    close(fd);
+}
+
+/*
+ * fork 之后父子进程共享末级页表。子进程改写偶数页、父进程改写奇数页，
+ * 各自只能看到自己的写入。子进程检查完后触碰 DONE_PAGES 个新页，父进程看到它的缺页计数后再检查。
+ */
+static void test_cow(void) {
+    char *p = mmap(NULL, COW_PAGES * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char *done = mmap(NULL, DONE_PAGES * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    check(p != MAP_FAILED && done != MAP_FAILED, "mmap for fork");
+    if (p == MAP_FAILED || done == MAP_FAILED) {
+        return;
+    }
+    fill(p, 0, COW_PAGES, 300);
+
+    int pid = fork();
+    if (pid == 0) {
+        for (int i = 0; i < COW_PAGES; i += 2) {
+            *page(p, i) = 400 + i;
+        }
+        int ok = 1;
+        for (int i = 0; i < COW_PAGES; i++) {
+            ok &= *page(p, i) == (i % 2 ? 300 : 400) + i;
+        }
+        check(ok, "fork child sees only its own writes");
+        fill(done, 0, DONE_PAGES, 0);
+        exit(ok ? 0 : 1);
+    }
+    check(pid > 0, "fork");
+    if (pid < 0) {
+        return;
+    }
+    for (int i = 1; i < COW_PAGES; i += 2) {
+        *page(p, i) = 500 + i;
+    }
+    struct fault_stat st;
+    int polls = 0;
+    do {
+        if (faultstat(pid, &st, NULL, 0) < 0) {
+            break;
+        }
+    } while (st.count[FAULT_ZERO] < DONE_PAGES && ++polls < WAIT_POLLS);
+    check(st.count[FAULT_ZERO] >= DONE_PAGES, "fork child finished");
+    int ok = 1;
+    for (int i = 0; i < COW_PAGES; i++) {
+        ok &= *page(p, i) == (i % 2 ? 500 : 300) + i;
+    }
+    check(ok, "fork parent sees only its own writes");
+    munmap(p, COW_PAGES * PGSIZE);
+    munmap(done, DONE_PAGES * PGSIZE);
+}
+
+int main() {
+    test_split();
+    test_eacces();
+    test_cow();
+    printf("vmtest: %s\n", failed ? RED "FAILED" CLEAR : GREEN "all passed" CLEAR);
+    return failed ? 1 : 0;
+}